@@ -25,20 +25,35 @@
 #include <SketchUpAPI/model/face.h>
 #include <SketchUpAPI/model/edge.h>
 #include <SketchUpAPI/model/vertex.h>
+#include <SketchUpAPI/model/entity.h>
+#include <SketchUpAPI/model/attribute_dictionary.h>
+#include <SketchUpAPI/model/typed_value.h>
 
 #include <SketchUpAPI/model/component_instance.h>
 #include <SketchUpAPI/model/component_definition.h>
 #include <SketchUpAPI/model/group.h>
 #include <SketchUpAPI/model/material.h>
 #include <SketchUpAPI/model/arccurve.h>
+#include <SketchUpAPI/model/geometry_input.h>
+#include <SketchUpAPI/model/loop_input.h>
 
 #include <vector>
 #include <iostream>
 #include <codecvt>
 #include <locale>
+#include <thread>
+#include <string>
+#include <unordered_map>
 
 #include "drill.h"
 #include "viyar.h"
+#include "geometry.h"
+#include "mesh.h"
+#include "detail_queue.h"
+#include "geom_pool.h"
+#include "layout.h"
+#include "nesting.h"
+#include "project_cache.h"
 
 /***************************************************************/
 /*                     Local Definitions                       */
@@ -47,6 +62,13 @@
 #define DEFAULT_COLOR_ALPHA_BAND 192
 #define DEFAULT_COLOR_ALPHA_SHEET 128
 
+/* Attribute dictionary on detail definitions */
+#define DETAIL_DICTIONARY       "viyar"
+#define DETAIL_DICTIONARY_HASH  "hash"
+
+/* Drill hole definitions, kept apart from detail definitions of the same name */
+#define DRILL_COMPONENT_PREFIX  "drill_D"
+
 
 /***************************************************************/
 /*                       Local Types                           */
@@ -57,6 +79,43 @@ typedef struct {
     SUMaterialRef mref;
 } SUMATERIAL_T;
 
+/* Instances one detail needs, details are released before reconciliation */
+typedef struct {
+    std::string name; //UTF-8, empty if detail has no name
+    double width;
+    double height;
+    double thickness;
+    size_t amount;
+} DETAIL_PLACEMENT_T;
+
+/* All details using one definition, in project order */
+typedef struct {
+    SUComponentDefinitionRef component;
+    std::vector<DETAIL_PLACEMENT_T> details;
+} DEFINITION_PLAN_T;
+
+/* State of one write_new_model() run */
+typedef struct {
+    SUModelRef model;
+    SUEntitiesRef entities;
+    const VIYAR_PROJECT_T *project;
+    MESH_T *mesh; //scratch geometry of one detail
+    std::unordered_map<std::string, SUComponentDefinitionRef> components; //by UTF-8 name
+    std::unordered_map<std::string, SUComponentDefinitionRef> drills; //drill hole definitions by name
+    std::unordered_map<std::string, std::string> hashes; //stored detail hash by definition name, read by workers
+    std::unordered_map<std::string, SUComponentDefinitionRef> stored; //existing definitions by stored detail hash
+    std::unordered_map<std::string, SUMaterialRef> materials; //by UTF-8 name
+    std::unordered_map<unsigned long long, SUComponentDefinitionRef> shared; //by detail_hash(), built in this run
+    std::vector<DEFINITION_PLAN_T> plans; //instances required at the end of the run
+    std::unordered_map<void *, size_t> plan_index; //by definition
+} MODEL_CTX_T;
+
+/* Parsed details go to the cache writer on their way to the queue */
+typedef struct {
+    PROJECT_CACHE_WRITER_T *writer; //NULL once caching failed
+    DETAIL_QUEUE_T *queue;
+} CACHE_TEE_T;
+
 /***************************************************************/
 /*                     Local Variables                         */
 /***************************************************************/
@@ -66,12 +125,6 @@ static VIYAR_PROJECT_T project = project_init();
 static SUMATERIAL_T *SUmaterials = NULL;
 static int SUmaterials_cnt = 0;
 
-static double _last_detail_position_X = 0;
-static double _last_detail_position_Y = 0;
-static double _max_detail_position_X = 0;
-static double _max_detail_position_Y = 0;
-static int _detail_position_direction = 0;
-
 /***************************************************************/
 /*                     Local Functions                         */
 /***************************************************************/
@@ -110,507 +163,620 @@ static char* toUTF8(const wchar_t* src)
     return output_buffer;
 }
 
-void _dump_detail(DETAIL_DEF_T *d)
+static std::string _su_string_to_utf8(SUStringRef name)
 {
-    if (!d)
+    size_t name_length = 0;
+    SU_CALL(SUStringGetUTF8Length(name, &name_length));
+    std::string name_utf8(name_length + 1, '\0');
+    SU_CALL(SUStringGetUTF8(name, name_length + 1, &name_utf8[0], &name_length));
+    name_utf8.resize(name_length);
+    return name_utf8;
+}
+
+/* Geometry version and detail_hash() of the parameters the definition was built from */
+static std::string _detail_hash_string(unsigned long long hash)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d:%016llx", GEOM_VERSION, hash);
+    return buf;
+}
+
+/* SUEntityGetAttributeDictionary() adds missing dictionaries, look it up without touching the entity */
+static bool _definition_dictionary(SUComponentDefinitionRef component, SUAttributeDictionaryRef *dictionary)
+{
+    SUEntityRef entity = SUComponentDefinitionToEntity(component);
+    size_t num_dictionaries = 0;
+    SU_CALL(SUEntityGetNumAttributeDictionaries(entity, &num_dictionaries));
+    if (num_dictionaries == 0)
     {
-        return;
+        return false;
     }
 
-    wprintf(L"name:        %s\n", d->name);
-    printf("size:        %.1f/%.1f/%.1f\n", d->width, d->height, d->thickness);
-    printf("amount:      %zd\n", d->amount);
+    std::vector<SUAttributeDictionaryRef> dictionaries(num_dictionaries);
+    SU_CALL(SUEntityGetAttributeDictionaries(entity, num_dictionaries, &dictionaries[0], &num_dictionaries));
+    for (size_t i = 0; i < num_dictionaries; i++)
+    {
+        SUStringRef name = SU_INVALID;
+        SU_CALL(SUStringCreate(&name));
+        SU_CALL(SUAttributeDictionaryGetName(dictionaries[i], &name));
+        bool found = (_su_string_to_utf8(name) == DETAIL_DICTIONARY);
+        SU_CALL(SUStringRelease(&name));
+
+        if (found)
+        {
+            *dictionary = dictionaries[i];
+            return true;
+        }
+    }
+    return false;
 }
 
-static void _add_face(SUEntitiesRef entities, SUPoint3D *vertices, size_t num_vertices, SUMaterialRef material)
+/* Empty string if definition has no hash (created by older version or by hand) */
+static std::string _definition_hash_get(SUComponentDefinitionRef component)
 {
-    SULoopInputRef outer_loop = SU_INVALID;
-    SU_CALL(SULoopInputCreate(&outer_loop));
-    for (size_t i = 0; i < num_vertices; ++i) {
-        SULoopInputAddVertexIndex(outer_loop, i);
+    SUAttributeDictionaryRef dictionary = SU_INVALID;
+    if (!_definition_dictionary(component, &dictionary))
+    {
+        return std::string();
     }
-    // Create the face
-    SUFaceRef face = SU_INVALID;
 
-    SU_CALL(SUFaceCreate(&face, vertices, &outer_loop));
+    SUTypedValueRef value = SU_INVALID;
+    SU_CALL(SUTypedValueCreate(&value));
 
-    if (!SUIsInvalid(material))
+    std::string hash;
+    if (SUAttributeDictionaryGetValue(dictionary, DETAIL_DICTIONARY_HASH, &value) == SU_ERROR_NONE)
     {
-        SU_CALL(SUFaceSetFrontMaterial(face, material));
-        SU_CALL(SUFaceSetBackMaterial(face, material));
+        SUStringRef str = SU_INVALID;
+        SU_CALL(SUStringCreate(&str));
+        if (SUTypedValueGetString(value, &str) == SU_ERROR_NONE)
+        {
+            hash = _su_string_to_utf8(str);
+        }
+        SU_CALL(SUStringRelease(&str));
     }
 
-    // Add the face to the entities
-    SU_CALL(SUEntitiesAddFaces(entities, 1, &face));
+    SU_CALL(SUTypedValueRelease(&value));
+    return hash;
+}
+
+static void _definition_hash_set(SUComponentDefinitionRef component, const std::string &hash)
+{
+    SUAttributeDictionaryRef dictionary = SU_INVALID;
+    SU_CALL(SUEntityGetAttributeDictionary(SUComponentDefinitionToEntity(component), DETAIL_DICTIONARY, &dictionary));
+
+    SUTypedValueRef value = SU_INVALID;
+    SU_CALL(SUTypedValueCreate(&value));
+    SU_CALL(SUTypedValueSetString(value, hash.c_str()));
+    SU_CALL(SUAttributeDictionarySetValue(dictionary, DETAIL_DICTIONARY_HASH, value));
+    SU_CALL(SUTypedValueRelease(&value));
 }
 
-static void _detail_add_drill(SUEntitiesRef entities, SUPoint3D corner, SUVector3D normal, const DRILL_T *dr)
+/* Index existing definitions once per model load, first definition wins for duplicate names */
+static void _component_index_build(MODEL_CTX_T *mc)
 {
-    SUPoint3D center = {MM2INCH(corner.x), MM2INCH(corner.y), MM2INCH(corner.z)};
+    size_t num_component_def = 0;
+    SU_CALL(SUModelGetNumComponentDefinitions(mc->model, &num_component_def));
+    if (num_component_def == 0)
+    {
+        return;
+    }
 
-    double X = MM2INCH(dr->x);
-    double Y = MM2INCH(dr->y);
-    double D = MM2INCH(dr->d);
-    double DEPTH = MM2INCH(dr->tdepth > 0 ? dr->tdepth : dr->depth);
+    std::vector<SUComponentDefinitionRef> components(num_component_def);
+    SU_CALL(SUModelGetComponentDefinitions(mc->model, num_component_def,
+                                           &components[0], &num_component_def));
 
-    if ((dr->side == SIDE_TOP) || (dr->side == SIDE_BOTTOM))
+    mc->components.reserve(num_component_def);
+    for (size_t i = 0; i < num_component_def; i++)
     {
-        center.z -= Y;
+        if (SUIsInvalid(components[i]))
+        {
+            continue;
+        }
+
+        SUStringRef name = SU_INVALID;
+        SU_CALL(SUStringCreate(&name));
+        SU_CALL(SUComponentDefinitionGetName(components[i], &name));
+        std::string name_utf8 = _su_string_to_utf8(name);
+        SU_CALL(SUStringRelease(&name));
+
+        // Detail definitions carry the hash, also the ones named like drills
+        std::string hash = _definition_hash_get(components[i]);
+        if (!hash.empty())
+        {
+            mc->hashes.emplace(name_utf8, hash);
+            mc->stored.emplace(hash, components[i]);
+        }
+        else if (name_utf8.compare(0, sizeof(DRILL_COMPONENT_PREFIX) - 1, DRILL_COMPONENT_PREFIX) == 0)
+        {
+            mc->drills.emplace(name_utf8, components[i]);
+            continue;
+        }
+        mc->components.emplace(name_utf8, components[i]);
     }
-    else
+}
+
+void _dump_detail(DETAIL_DEF_T *d)
+{
+    if (!d)
     {
-        center.y += Y;
+        return;
     }
 
-    if ((dr->side == SIDE_LEFT) || (dr->side == SIDE_RIGHT))
+    wprintf(L"name:        %s\n", d->name);
+    printf("size:        %.1f/%.1f/%.1f\n", d->width, d->height, d->thickness);
+    printf("amount:      %zd\n", d->amount);
+}
+
+/* SketchUp geometry backend, geometry comes in mm */
+static SUPoint3D _su_point(const GEOM_POINT_T *p)
+{
+    SUPoint3D point = {MM2INCH(p->x), MM2INCH(p->y), MM2INCH(p->z)};
+    return point;
+}
+
+/* Commit whole detail mesh with one SUEntitiesFill() call, circles follow as
+ * arc curves. Vertices are shared between faces, so SketchUp welds the edges
+ * instead of merging coincident geometry face by face */
+static void _su_fill_mesh(SUEntitiesRef entities, const MESH_T *mesh)
+{
+    size_t num_vertices, num_indices, num_faces, num_edges, num_curves;
+    const GEOM_POINT_T *vertices = mesh_vertices(mesh, &num_vertices);
+    const unsigned int *indices = mesh_indices(mesh, &num_indices);
+    const MESH_FACE_T *faces = mesh_faces(mesh, &num_faces);
+    const MESH_EDGE_T *edges = mesh_edges(mesh, &num_edges);
+    const MESH_CURVE_T *curves = mesh_curves(mesh, &num_curves);
+
+    if (num_vertices == 0)
     {
-        center.z -= X;
+        return;
     }
-    else
+
+    SUGeometryInputRef input = SU_INVALID;
+    SU_CALL(SUGeometryInputCreate(&input));
+
+    std::vector<SUPoint3D> points(num_vertices);
+    for (size_t i = 0; i < num_vertices; i++)
     {
-        center.x += X;
+        points[i] = _su_point(&vertices[i]);
     }
+    SU_CALL(SUGeometryInputSetVertices(input, num_vertices, &points[0]));
+
+    for (size_t i = 0; i < num_faces; i++)
+    {
+        SULoopInputRef outer_loop = SU_INVALID;
+        SU_CALL(SULoopInputCreate(&outer_loop));
+        for (size_t j = 0; j < faces[i].count; j++)
+        {
+            SU_CALL(SULoopInputAddVertexIndex(outer_loop, indices[faces[i].first + j]));
+        }
 
-    SUPoint3D start_point = center;
+        // Geometry input takes ownership of the loop
+        size_t face_index = 0;
+        SU_CALL(SUGeometryInputAddFace(input, &outer_loop, &face_index));
 
-    if ((dr->side == SIDE_LEFT) || (dr->side == SIDE_RIGHT))
+        int m_id = faces[i].material_id;
+        if ((m_id > 0) && (m_id <= SUmaterials_cnt))
+        {
+            SUMaterialInput material;
+            memset(&material, 0, sizeof(material));
+            material.material = SUmaterials[m_id-1].mref;
+            SU_CALL(SUGeometryInputFaceSetFrontMaterial(input, face_index, &material));
+            SU_CALL(SUGeometryInputFaceSetBackMaterial(input, face_index, &material));
+        }
+    }
+
+    // Circle edges are created by SketchUp together with their arc curve,
+    // added after the fill: SUGeometryInputAddArcCurve() is not in the 2016/2017 SDK
+    std::vector<bool> curve_edge(num_edges, false);
+    for (size_t i = 0; i < num_curves; i++)
     {
-        start_point.z += D/2;
+        for (size_t j = 0; j < curves[i].count; j++)
+        {
+            curve_edge[curves[i].first_edge + j] = true;
+        }
     }
-    else
+
+    for (size_t i = 0; i < num_edges; i++)
     {
-        start_point.x += D/2;
+        if (!curve_edge[i])
+        {
+            size_t edge_index = 0;
+            SU_CALL(SUGeometryInputAddEdge(input, edges[i].a, edges[i].b, &edge_index));
+        }
     }
 
-    SUArcCurveRef arccurve = SU_INVALID;
-    SU_CALL(SUArcCurveCreate(&arccurve, &center, &start_point, &start_point, &normal, 16));
+    SU_CALL(SUEntitiesFill(entities, input, true));
+    SU_CALL(SUGeometryInputRelease(&input));
 
-    // Add the ArcCyrves to the entities
-    SU_CALL(SUEntitiesAddArcCurves(entities, 1, &arccurve));
+    if (num_curves == 0)
+    {
+        return;
+    }
 
-    SUPoint3D center2 = {
-        center.x + normal.x*DEPTH,
-        center.y + normal.y*DEPTH,
-        center.z + normal.z*DEPTH,
-    };
+    std::vector<SUArcCurveRef> arccurves(num_curves);
+    for (size_t i = 0; i < num_curves; i++)
+    {
+        // Full circle: starts and ends at first tessellated vertex
+        SUPoint3D start = points[edges[curves[i].first_edge].a];
+        SUPoint3D center = _su_point(&curves[i].center);
+        SUVector3D normal = {curves[i].normal.x, curves[i].normal.y, curves[i].normal.z};
+        SUSetInvalid(arccurves[i]);
+        SU_CALL(SUArcCurveCreate(&arccurves[i], &center, &start, &start, &normal, curves[i].count));
+    }
+
+    // Add the ArcCurves to the entities
+    SU_CALL(SUEntitiesAddArcCurves(entities, num_curves, &arccurves[0]));
+}
 
-    start_point = center2;
-    if ((dr->side == SIDE_LEFT) || (dr->side == SIDE_RIGHT))
+/* One definition per drill signature, found by name in existing models too */
+static SUComponentDefinitionRef _drill_component(MODEL_CTX_T *mc, const DRILL_T *dr)
+{
+    bool face = (dr->side == SIDE_FRONT) || (dr->side == SIDE_BACK);
+    char name[64];
+    if (dr->tdepth > 0)
     {
-        start_point.z += D/2;
+        snprintf(name, sizeof(name), DRILL_COMPONENT_PREFIX "%.2f_through%.2f_%s", dr->d, dr->tdepth, face ? "face" : "edge");
     }
     else
     {
-        start_point.x += D/2;
+        snprintf(name, sizeof(name), DRILL_COMPONENT_PREFIX "%.2f_depth%.2f_%s", dr->d, dr->depth, face ? "face" : "edge");
     }
 
-    SUArcCurveRef arccurve2 = SU_INVALID;
-    SU_CALL(SUArcCurveCreate(&arccurve2, &center2, &start_point, &start_point, &normal, 16));
+    auto it = mc->drills.find(name);
+    if (it != mc->drills.end())
+    {
+        return it->second;
+    }
 
-    // Add the ArcCyrves to the entities
-    SU_CALL(SUEntitiesAddArcCurves(entities, 1, &arccurve2));
+    SUComponentDefinitionRef component = SU_INVALID;
+    SU_CALL(SUComponentDefinitionCreate(&component));
+    SU_CALL(SUComponentDefinitionSetName(component, name));
+    SU_CALL(SUModelAddComponentDefinitions(mc->model, 1, &component));
+
+    SUEntitiesRef entities = SU_INVALID;
+    SU_CALL(SUComponentDefinitionGetEntities(component, &entities));
 
-    SUEdgeRef edge = SU_INVALID;
-    SU_CALL(SUEdgeCreate(&edge, &center, &center2));
+    MESH_T *mesh = mesh_create();
+    GEOM_SINK_T sink = mesh_sink(mesh, false);
+    geom_drill_hole(dr, &sink);
+    _su_fill_mesh(entities, mesh);
+    mesh_destroy(mesh);
 
-    // Add the Edge to the entities
-    SU_CALL(SUEntitiesAddEdges(entities, 1, &edge));
+    mc->drills.emplace(name, component);
+    return component;
 }
 
-/* (points [*num_points-1]) contains current corner point */
-static int _corner_operation(SUPoint3D points[12], int *band_materials, size_t *num_points, size_t cn, OPERATION_T *cop)
+/* Hole definition axis is +z from origin, map it to hole center and normal */
+static void _hole_transform(const MESH_HOLE_T *hole, struct SUTransformation *transform)
 {
-    if (!cop)
-    {
-        return 0;
-    }
-
-    SUPoint3D original_point = points[(*num_points)-1];
+    const GEOM_POINT_T *n = &hole->normal;
+    GEOM_POINT_T start;
+    geom_circle_start(&hole->center, n, 1.0, &start);
+
+    GEOM_POINT_T u = {start.x - hole->center.x, start.y - hole->center.y, start.z - hole->center.z};
+    GEOM_POINT_T v = {
+        n->y * u.z - n->z * u.y,
+        n->z * u.x - n->x * u.z,
+        n->x * u.y - n->y * u.x,
+    };
 
-    double X = cop->x;
-    double Y = cop->y;
-    int material_H = 1; //same as for sheet
-    int material_V = 1;
+    double values[16] = {
+        u.x, u.y, u.z, 0.0,
+        v.x, v.y, v.z, 0.0,
+        n->x, n->y, n->z, 0.0,
+        MM2INCH(hole->center.x), MM2INCH(hole->center.y), MM2INCH(hole->center.z), 1.0,
+    };
+    memcpy(transform->values, values, sizeof(values));
+}
 
-    if (cop->edgeMaterial > 0)
+/* mesh is geometry generated by a pool worker, NULL to generate it here */
+static int _create_detail_component(MODEL_CTX_T *mc, SUEntitiesRef entities, DETAIL_DEF_T *d, const MESH_T *mesh)
+{
+    if (mesh == NULL)
     {
-        MATERIAL_DEF_T *m = SUmaterials[cop->edgeMaterial-1].mdef;
+        mesh_reset(mc->mesh);
+        GEOM_SINK_T sink = mesh_sink(mc->mesh, true);
 
-        if (cop->edgeCovering == EDGE_COVER_BOTH)
-        {
-            X -= m->thickness;
-            Y -= m->thickness;
-            material_H = cop->edgeMaterial;
-            material_V = cop->edgeMaterial;
-            //printf("Set both material_H, material_V=%d\n", material_H);
-        }
-        else if (cop->edgeCovering == EDGE_COVER_H)
-        {
-            material_H = cop->edgeMaterial;
-            Y -= m->thickness;
-            //printf("Set material_H=%d\n", material_H);
-        }
-        else if (cop->edgeCovering == EDGE_COVER_V)
+        int res = geom_detail(d, mc->project, &sink);
+        if (res != 0)
         {
-            material_V = cop->edgeMaterial;
-            X -= m->thickness;
-            //printf("Set material_V=%d\n", material_V);
+            return res;
         }
+        mesh = mc->mesh;
     }
 
+    _su_fill_mesh(entities, mesh);
 
-    if (cn == CORNER_LOWER_LEFT)
+    // Drill holes are instances of shared definitions
+    size_t num_holes = 0;
+    const MESH_HOLE_T *holes = mesh_holes(mesh, &num_holes);
+    for (size_t i = 0; i < num_holes; i++)
     {
-        points[(*num_points)-1].x += (X);
-        band_materials[(*num_points)-1] = material_H;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
-        if (cop->subtype == 3)
-        {
-            points[(*num_points)++] = points[(*num_points)-1];
-            points[(*num_points)-1].y += (Y);
-            band_materials[(*num_points)-1] = material_V;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
-        }
+        SUComponentDefinitionRef component = _drill_component(mc, &holes[i].drill);
 
-        points[(*num_points)++] = original_point;
-        points[(*num_points)-1].y += (Y);
-        band_materials[(*num_points)-1] = material_V;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
-    }
-    else if (cn == CORNER_UPPER_LEFT)
-    {
-        points[(*num_points)-1].y -= (Y);
-        band_materials[(*num_points)-1] = material_V;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
-        if (cop->subtype == 3)
-        {
-            points[(*num_points)++] = points[(*num_points)-1];
-            points[(*num_points)-1].x += (X);
-            band_materials[(*num_points)-1] = material_H;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
-        }
+        struct SUTransformation transform;
+        _hole_transform(&holes[i], &transform);
 
-        points[(*num_points)++] = original_point;
-        points[(*num_points)-1].x += X;
-        band_materials[(*num_points)-1] = material_H;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
+        SUComponentInstanceRef instance = SU_INVALID;
+        SU_CALL(SUComponentDefinitionCreateInstance(component, &instance));
+        SU_CALL(SUComponentInstanceSetTransform(instance, &transform));
+        SU_CALL(SUEntitiesAddInstance(entities, instance, NULL));
+    }
+    return 0;
+}
 
-        points[(*num_points)-1].x += X;
+/* Record instances detail_def needs, they are placed by _reconcile_instances() */
+static void _plan_detail(MODEL_CTX_T *mc, SUComponentDefinitionRef component, const DETAIL_DEF_T *detail_def)
+{
+    auto it = mc->plan_index.emplace(component.ptr, mc->plans.size());
+    if (it.second)
+    {
+        DEFINITION_PLAN_T plan;
+        plan.component = component;
+        mc->plans.push_back(plan);
     }
-    else if (cn == CORNER_UPPER_RIGHT)
+
+    DETAIL_PLACEMENT_T placement;
+    if (detail_def->name != NULL)
     {
-        points[(*num_points)-1].x -= (X);
-        band_materials[(*num_points)-1] = material_H;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
-        if (cop->subtype == 3)
+        char *utf8 = toUTF8(detail_def->name);
+        placement.name = utf8;
+        free(utf8);
+    }
+    placement.width = detail_def->width;
+    placement.height = detail_def->height;
+    placement.thickness = detail_def->thickness;
+    placement.amount = detail_def->amount;
+
+    mc->plans[it.first->second].details.push_back(placement);
+}
+
+typedef struct {
+    SUComponentDefinitionRef component;
+    std::vector<SUComponentInstanceRef> instances;
+} EXISTING_INSTANCES_T;
+
+/* Instances of one detail, stacked on the same place */
+typedef struct {
+    const DEFINITION_PLAN_T *plan;
+    const DETAIL_PLACEMENT_T *placement;
+    struct SUTransformation transform;
+    size_t keep; //existing instances, the stack grows on top of them
+    size_t item; //layout item when the stack needs a new place
+} DETAIL_STACK_T;
+
+/* Bring instance count of every definition to what the project requires:
+ * existing instances keep their transforms, surplus ones are erased with one
+ * SUEntitiesErase() call and missing ones are created and added together.
+ * Instances of detail definitions no longer in the project are removed too */
+static void _reconcile_instances(MODEL_CTX_T *mc)
+{
+    struct SUTransformation identity = {
         {
-            points[(*num_points)++] = points[(*num_points)-1];
-            points[(*num_points)-1].y -= (Y);
-            band_materials[(*num_points)-1] = material_V;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
-        }
+            1.0,    0.0,    0.0,    0.0,
+            0.0,    1.0,    0.0,    0.0,
+            0.0,    0.0,    1.0,    0.0,
+            0.0,    0.0,    0.0,    1,
+        } };
 
-        points[(*num_points)++] = original_point;
-        points[(*num_points)-1].y -= (Y);
-        band_materials[(*num_points)-1] = material_V;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
-    }
-    else if (cn == CORNER_LOWER_RIGHT)
+    // Group existing top level instances by definition
+    std::unordered_map<void *, EXISTING_INSTANCES_T> existing;
+    size_t num_instances = 0;
+    SU_CALL(SUEntitiesGetNumInstances(mc->entities, &num_instances));
+    if (num_instances > 0)
     {
-        points[(*num_points)-1].y += (Y);
-        band_materials[(*num_points)-1] = material_V;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
-        if (cop->subtype == 3)
+        std::vector<SUComponentInstanceRef> instances(num_instances);
+        SU_CALL(SUEntitiesGetInstances(mc->entities, num_instances, &instances[0], &num_instances));
+        for (size_t i = 0; i < num_instances; i++)
         {
-            points[(*num_points)++] = points[(*num_points)-1];
-            points[(*num_points)-1].x -= (X);
-            band_materials[(*num_points)-1] = material_H;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
+            SUComponentDefinitionRef component = SU_INVALID;
+            SU_CALL(SUComponentInstanceGetDefinition(instances[i], &component));
+            EXISTING_INSTANCES_T &e = existing[component.ptr];
+            e.component = component;
+            e.instances.push_back(instances[i]);
         }
-
-        points[(*num_points)++] = original_point;
-        points[(*num_points)-1].x -= (X);
-        band_materials[(*num_points)-1] = material_H;
-//        wprintf(L"Added new point %.3f %.3f for corner %zd\n",
-//                points[(*num_points)-1].x, points[(*num_points)-1].y, cn);
     }
 
-    return 0;
-}
-
-static int _create_detail_component(SUEntitiesRef entities, DETAIL_DEF_T *d)
-{
+    std::vector<SUEntityRef> surplus;
+    std::vector<SUComponentInstanceRef> added;
+    std::vector<DETAIL_STACK_T> stacks;
+    size_t kept = 0;
+    double kept_top = 0; //inch, new stacks are laid out above kept ones
 
-    //End coordinates of detail in INCHES
-    double X = (d->width);
-    double Y = (d->height);
-    double Z = (d->thickness);
+    LAYOUT_T *layout = layout_create(DISTANCE_X, DISTANCE_Y);
 
-    OPERATION_T *corner[CORNER_MAX];
-    size_t num_corner_operations = 0;
-    memset(corner, 0, sizeof(corner));
-    for (size_t j = 0; j < d->operations_cnt; j++)
+    for (size_t i = 0; i < mc->plans.size(); i++)
     {
-        OPERATION_T *op = &d->operations[j];
-        if (op->type == TYPE_CORNEROPERATION)
+        const DEFINITION_PLAN_T *plan = &mc->plans[i];
+        std::vector<SUComponentInstanceRef> present;
+        auto e = existing.find(plan->component.ptr);
+        if (e != existing.end())
         {
-            wprintf(L"%zd: Corner operation: corner=%d, subtype=%d, x=%.1f, y=%.1f, r=%.f, mill=%d, "
-                    "ext=%d, edgeMaterial=%d, edgeCovering=%d\n",
-                    j, op->corner, op->subtype, op->x, op->y, op->r, op->mill, op->ext, op->edgeMaterial, op->edgeCovering);
+            present.swap(e->second.instances);
+            existing.erase(e);
+        }
 
-            if ((op->corner <= 0) || (op->corner > CORNER_MAX))
+        size_t used = 0;
+        for (size_t j = 0; j < plan->details.size(); j++)
+        {
+            DETAIL_STACK_T stack;
+            stack.plan = plan;
+            stack.placement = &plan->details[j];
+            stack.transform = identity;
+            stack.keep = MIN(stack.placement->amount, present.size() - used);
+            stack.item = SIZE_MAX;
+
+            // Missing instances go on top of the detail's stack, or to a new place
+            if (stack.keep > 0)
             {
-                PARSE_FAIL(-1);
+                SU_CALL(SUComponentInstanceGetTransform(present[used], &stack.transform));
+                kept_top = MAX(kept_top, stack.transform.values[13] + MM2INCH(stack.placement->height));
             }
-
-            if (op->subtype != 3)
+            else if (stack.placement->amount > 0)
             {
-                wprintf(L"TODO: Corner operation subtype=%d not supported.\n", op->subtype);
-                continue;
+                stack.item = layout_add(layout, stack.placement->width, stack.placement->height);
             }
 
-            if (op->ext != 1)
+            if (stack.keep < stack.placement->amount)
             {
-                wprintf(L"TODO: Corner operation subtype=%d ext=%d not supported.\n", op->subtype, op->ext);
-                continue;
+                stacks.push_back(stack);
             }
+            used += stack.keep;
+        }
 
-            corner[op->corner-1] = op;
-            num_corner_operations++;
-        }
-        else if (op->type != TYPE_DRILLING)
-        {
-            //wprintf(L"TODO: Operation type=%d not supported.\n", op->type);
-        }
-    }
-
-
-    SUPoint3D sides[6][4] = {
-        {   //SIDE_FRONT
-            { 0, 0, Z },
-            { 0, Y, Z },
-            { X, Y, Z },
-            { X, 0, Z },
-        },
-        {   //SIDE_LEFT
-            { 0, 0, Z },
-            { 0, Y, Z },
-            { 0, Y, 0 },
-            { 0, 0, 0 },
-        },
-        {   //SIDE_TOP
-            { 0, Y, Z },
-            { X, Y, Z },
-            { X, Y, 0 },
-            { 0, Y, 0 },
-        },
-        {   //SIDE_RIGHT
-            { X, 0, Z },
-            { X, 0, 0 },
-            { X, Y, 0 },
-            { X, Y, Z },
-        },
-        {   //SIDE_BOTTOM
-            { 0, 0, Z },
-            { 0, 0, 0 },
-            { X, 0, 0 },
-            { X, 0, Z },
-        },
-        {   //SIDE_BACK
-            { 0, 0, 0 },
-            { 0, Y, 0 },
-            { X, Y, 0 },
-            { X, 0, 0 },
-        },
-    };
-
-    SUVector3D normals[6] = {
-        { 0,  0, -1},  //SIDE_FRONT
-        { 1,  0,  0},  //SIDE_LEFT
-        { 0, -1,  0},  //SIDE_TOP
-        {-1,  0,  0},  //SIDE_RIGHT
-        { 0,  1,  0},  //SIDE_BOTTOM
-        { 0,  0,  1},  //SIDE_BACK
-    };
-
-    //for now it can be maximum 3*4
-    SUPoint3D sheet_points[12];
-    size_t num_sheet_points = 0;
+        kept += used;
+        for (size_t j = used; j < present.size(); j++)
+        {
+            surplus.push_back(SUComponentInstanceToEntity(present[j]));
+        }
+    }
 
-    int band_materials[12]; //material index corresponds to the starting point of sheet_points
-    memset(band_materials, 0, sizeof(band_materials));
+    layout_pack(layout);
+    double origin_y = (kept > 0) ? kept_top + MM2INCH(DISTANCE_Y) : 0;
 
-    SUMaterialRef material = SU_INVALID;
-    if (d->m_bands[SIDE_FRONT])
+    for (size_t i = 0; i < stacks.size(); i++)
     {
-        int m_id = d->m_bands[SIDE_FRONT];
-        MATERIAL_DEF_T *m = SUmaterials[m_id-1].mdef;
-        material = SUmaterials[m_id-1].mref;
-    }
+        DETAIL_STACK_T *stack = &stacks[i];
+        const DETAIL_PLACEMENT_T *p = stack->placement;
+        struct SUTransformation transform = stack->transform;
 
-    for (size_t cn = 0; cn < CORNER_MAX; cn++)
-    {
-        sheet_points[num_sheet_points++] = sides[SIDE_FRONT][cn];
-        _corner_operation(sheet_points, band_materials, &num_sheet_points, cn, corner[cn]);
-        band_materials[num_sheet_points-1] = d->m_bands[cn+1];
-    }
+        if (stack->item != SIZE_MAX)
+        {
+            double x, y;
+            layout_position(layout, stack->item, &x, &y);
+            transform.values[12] = MM2INCH(x);
+            transform.values[13] = origin_y + MM2INCH(y);
+        }
+        double base_z = transform.values[14];
 
-    for (size_t j = 0 ; j < num_sheet_points; j++)
-    {
-        sheet_points[j].x =  MM2INCH(sheet_points[j].x);
-        sheet_points[j].y =  MM2INCH(sheet_points[j].y);
-        sheet_points[j].z =  MM2INCH(sheet_points[j].z);
+        for (size_t k = stack->keep; k < p->amount; k++)
+        {
+            transform.values[14] = base_z + MM2INCH(k*p->thickness * DISTANCE_Z);
+
+            SUComponentInstanceRef instance = SU_INVALID;
+            SU_CALL(SUComponentDefinitionCreateInstance(stack->plan->component, &instance));
+            SU_CALL(SUComponentInstanceSetTransform(instance, &transform));
+            if (!p->name.empty())
+            {
+                SU_CALL(SUComponentInstanceSetName(instance, p->name.c_str()));
+            }
+            added.push_back(instance);
+        }
     }
 
-    num_sheet_points  = num_sheet_points;
-    _add_face(entities, sheet_points, num_sheet_points, material);
+    double layout_width, layout_height;
+    layout_extents(layout, &layout_width, &layout_height);
+    layout_destroy(layout);
 
-    for (size_t j = 0 ; j < num_sheet_points ; j++)
+    // Details removed from the project, other components are left alone
+    for (auto it = existing.begin(); it != existing.end(); ++it)
     {
-        SUMaterialRef material = SU_INVALID;
-
-        if (band_materials[j])
+        SUAttributeDictionaryRef dictionary = SU_INVALID;
+        if (_definition_dictionary(it->second.component, &dictionary))
         {
-            int m_id = band_materials[j];
-            MATERIAL_DEF_T *m = SUmaterials[m_id-1].mdef;
-            material = SUmaterials[m_id-1].mref;
+            for (size_t j = 0; j < it->second.instances.size(); j++)
+            {
+                surplus.push_back(SUComponentInstanceToEntity(it->second.instances[j]));
+            }
         }
-
-        SUPoint3D points[4];
-
-        points[0] = sheet_points[j];
-        points[1] = sheet_points[(j+1) % num_sheet_points];
-        points[2] = points[1];
-        points[2].z = 0;
-        points[3] = points[0];
-        points[3].z = 0;
-
-        //add material
-        _add_face(entities, points, 4, material);
     }
 
-    if (d->m_bands[SIDE_BACK])
+    if (!surplus.empty())
     {
-        int m_id = d->m_bands[SIDE_BACK];
-        MATERIAL_DEF_T *m = SUmaterials[m_id-1].mdef;
-        material = SUmaterials[m_id-1].mref;
+        SU_CALL(SUEntitiesErase(mc->entities, surplus.size(), &surplus[0]));
     }
 
-    for (size_t j = 0 ; j < num_sheet_points; j++)
+    for (size_t i = 0; i < added.size(); i++)
     {
-        sheet_points[j].z = 0;
+        SU_CALL(SUEntitiesAddInstance(mc->entities, added[i], NULL));
     }
 
-    _add_face(entities, sheet_points, num_sheet_points, material);
+    printf("Instances: %zd kept, %zd added, %zd removed, new stacks laid out in %.0fx%.0f mm\n",
+           kept, added.size(), surplus.size(), layout_width, layout_height);
+}
 
-    for (int i = 0; i < 6; ++i)
+/* Pool worker callback: only mc->hashes is read, it is not modified while workers run */
+static bool _detail_need_geometry(const DETAIL_DEF_T *detail, unsigned long long hash, void *data)
+{
+    MODEL_CTX_T *mc = (MODEL_CTX_T *)data;
+    if (detail->name == NULL)
     {
-        for (size_t j = 0; j < d->operations_cnt; j++)
-        {
-            OPERATION_T *op = &d->operations[j];
-            if ((op->type == TYPE_DRILLING) && (op->side == i+1))
-            {
-                DRILL_T dr;
-                dr.d = op->d;
-                dr.x = op->x;
-                dr.y = op->y;
-                dr.depth = op->depth;
-                dr.tdepth = 0;
-                dr.side = i;
-
-                if (((i == SIDE_FRONT) || (i == SIDE_BACK))
-                        && (dr.depth > d->thickness))
-                {
-                    dr.tdepth = d->thickness;
-                }
-
-                _detail_add_drill(entities, sides[i][0], normals[i], &dr);
-                drill_append(&dr, d->amount);
-            }
-        }
+        return true;
     }
-    return 0;
+
+    char *utf8 = toUTF8(detail->name);
+    auto it = mc->hashes.find(utf8);
+    free(utf8);
+
+    return (it == mc->hashes.end()) || (it->second != _detail_hash_string(hash));
 }
 
-static void _add_update_detail_components(SUModelRef model, DETAIL_DEF_T *detail_def)
+static void _add_update_detail_components(MODEL_CTX_T *mc, GEOM_RESULT_T *result)
 {
+    DETAIL_DEF_T *detail_def = &result->detail;
     char *utf8 = NULL;
-    SUEntitiesRef entities = SU_INVALID;
     SUComponentDefinitionRef component = SU_INVALID;
-    SUComponentInstanceRef instance = SU_INVALID;
     size_t componentNumInstancesCount = 0;
     bool ComponentFound = false;
 
-    //faces locations inside the component_def
-    struct SUTransformation transform = {
-        {
-            1.0,    0.0,    0.0,    0.0,
-            0.0,    1.0,    0.0,    0.0,
-            0.0,    0.0,    1.0,    0.0,
-            0.0,    0.0,    0.0,    1,
-        } };
-
     if (detail_def->amount == 0)
     {
         wprintf(L"detail_def->amount = 0 - skip adding component.");
         return;
     }
 
-    SU_CALL(SUModelGetEntities(model, &entities));
+    unsigned long long hash = result->hash;
+    auto shared = mc->shared.find(hash);
+    if (shared != mc->shared.end())
+    {
+        wprintf(L"Detail %d '%s' is identical to a previous one - add %zd instances.\n",
+                detail_def->id, detail_def->name ? detail_def->name : L"", detail_def->amount);
+        _plan_detail(mc, shared->second, detail_def);
+        return;
+    }
 
     if (detail_def->name != NULL)
     {
         utf8 = toUTF8(detail_def->name);
 
-        size_t num_component_def = 0;
-        SUModelGetNumComponentDefinitions(model, &num_component_def);
-
-        if (num_component_def > 0)
+        auto it = mc->components.find(utf8);
+        if (it != mc->components.end())
         {
-            std::vector<SUComponentDefinitionRef> components(num_component_def);
-            SUModelGetComponentDefinitions(model, num_component_def,
-                                           &components[0], &num_component_def);
+            ComponentFound = true;
+            component = it->second;
+            //SU_CALL(SUComponentDefinitionGetNumInstances(component, &componentNumInstancesCount));
+            SU_CALL(SUComponentDefinitionGetNumUsedInstances(component, &componentNumInstancesCount));
+        }
+    }
 
-            for (size_t i = 0; (i < num_component_def) && !ComponentFound; i++)
-            {
-                component = components[i];
-                if (!SUIsInvalid(component))
-                {
-                    SUStringRef name = SU_INVALID;
-                    SU_CALL(SUStringCreate(&name));
-                    SU_CALL(SUComponentDefinitionGetName(component, &name));
-                    size_t name_length = 0;
-                    SU_CALL(SUStringGetUTF8Length(name, &name_length));
-                    char* name_utf8 = new char[name_length + 1];
-                    SU_CALL(SUStringGetUTF8(name, name_length + 1, name_utf8, &name_length));
-                    // Now we have the name in a form we can use
-                    SU_CALL(SUStringRelease(&name));
-
-                    ComponentFound = (strcmp(utf8, name_utf8) == 0);
-                    delete []name_utf8;
-
-                    //SU_CALL(SUComponentDefinitionGetNumInstances(component, &componentNumInstancesCount));
-                    SU_CALL(SUComponentDefinitionGetNumUsedInstances(component, &componentNumInstancesCount));
-                }
-            }
+    std::string hash_str = _detail_hash_string(hash);
+    bool rebuild = true;
+
+    // Geometry planned for earlier details of this run (they may be shared by
+    // hash under other names) is never replaced, the detail gets its own definition
+    if (ComponentFound && (mc->plan_index.find(component.ptr) != mc->plan_index.end())
+        && (_definition_hash_get(component) != hash_str))
+    {
+        wprintf(L"Component '%s' is used by a detail with other geometry - add another one.\n", detail_def->name);
+        ComponentFound = false;
+
+        // Left by the previous run of the same project
+        auto stored = mc->stored.find(hash_str);
+        if ((stored != mc->stored.end()) && (mc->plan_index.find(stored->second.ptr) == mc->plan_index.end()))
+        {
+            ComponentFound = true;
+            component = stored->second;
+            SU_CALL(SUComponentDefinitionGetNumUsedInstances(component, &componentNumInstancesCount));
         }
     }
 
     if (ComponentFound)
     {
-        wprintf(L"Found component with name '%s', instances =%zd (required %zd) - update it.\n",
-                detail_def->name, componentNumInstancesCount, detail_def->amount);
+        // Revised projects usually change few details, keep the rest untouched
+        rebuild = (_definition_hash_get(component) != hash_str);
+        wprintf(L"Found component with name '%s', instances =%zd (required %zd) - %s.\n",
+                detail_def->name, componentNumInstancesCount, detail_def->amount,
+                rebuild ? L"update it" : L"geometry unchanged");
     }
     else
     {
@@ -623,30 +789,22 @@ static void _add_update_detail_components(SUModelRef model, DETAIL_DEF_T *detail
             SU_CALL(SUComponentDefinitionSetName(component, utf8));
         }
 
-        SU_CALL(SUModelAddComponentDefinitions(model, 1, &component));
-    }
-
-    free(utf8);
+        SU_CALL(SUModelAddComponentDefinitions(mc->model, 1, &component));
 
-    if (componentNumInstancesCount > 0)
-    {
-        size_t instance_count;
-        SU_CALL(SUComponentDefinitionGetInstances(component, 1, &instance, &instance_count));
+        // First definition with the name stays in the index
+        if (utf8 != NULL)
+        {
+            mc->components.emplace(utf8, component);
+        }
     }
-    else
-    {
-        // Add instance for this definition
-        SU_CALL(SUComponentDefinitionCreateInstance(component, &instance));
 
-        // Set default transformation for new component
-        SU_CALL(SUComponentInstanceSetTransform(instance, &transform));
-    }
+    free(utf8);
 
     // Populate the entities of the definition using recursion
     SUEntitiesRef instance_entities = SU_INVALID;
     SU_CALL(SUComponentDefinitionGetEntities(component, &instance_entities));
 
-    if (ComponentFound)
+    if (ComponentFound && rebuild)
     {
         size_t faceCount = 0;
         SU_CALL(SUEntitiesGetNumFaces(instance_entities, &faceCount));
@@ -684,142 +842,124 @@ static void _add_update_detail_components(SUModelRef model, DETAIL_DEF_T *detail
             //SU_CALL(SUEntitiesGetNumEdges(instance_entities, false, &edgeCount));
         }
 
-    }
-
-    // Create detail component
-    _create_detail_component(instance_entities, detail_def);
-
-/*
-    size_t edgeCount = 0;
-    SU_CALL(SUEntitiesGetNumEdges(instance_entities, false, &edgeCount));
-    printf("and now edgeCount=%zd\n", edgeCount);
-*/
-    if (detail_def->amount > componentNumInstancesCount)
-    {
-        // Need to add some component instances to the model
-        _max_detail_position_X = MAX(_max_detail_position_X, _last_detail_position_X);
-        _max_detail_position_Y = MAX(_max_detail_position_Y, _last_detail_position_Y);
-
-        // Do position determination (depending on target detail size)
-        if (_detail_position_direction == 0)
+        size_t holeCount = 0;
+        SU_CALL(SUEntitiesGetNumInstances(instance_entities, &holeCount));
+        if (holeCount > 0)
         {
-            if ((_max_detail_position_X > 0) && (_last_detail_position_X + detail_def->width > _max_detail_position_X))
+            std::vector<SUComponentInstanceRef> holes(holeCount);
+            SU_CALL(SUEntitiesGetInstances(instance_entities, holeCount, &holes[0], &holeCount));
+            std::vector<SUEntityRef> elements(holeCount);
+            for (size_t i = 0; i < holeCount; i++)
             {
-                _last_detail_position_X = _max_detail_position_X + DISTANCE_X;
-                _last_detail_position_Y = 0;
-                _max_detail_position_X = MAX(_max_detail_position_X, _last_detail_position_X + detail_def->width);
-                _detail_position_direction = 1;
+                elements[i] = SUComponentInstanceToEntity(holes[i]);
             }
-            else
-            {
-                //Update _max_detail_position_Y to size of detail
-                _max_detail_position_Y = MAX(_max_detail_position_Y, _last_detail_position_Y + detail_def->height);
-            }
-        }
-        else
-        {
-            if ((_max_detail_position_Y > 0) && (_last_detail_position_Y + detail_def->height > _max_detail_position_Y))
-            {
-                _last_detail_position_Y = _max_detail_position_Y + DISTANCE_Y;
-                _last_detail_position_X = 0;
-                _max_detail_position_Y = MAX(_max_detail_position_Y, _last_detail_position_Y + detail_def->height);
-                _detail_position_direction = 0;
-            }
-            else
-            {
-                //Update _max_detail_position_Y to size of detail
-                _max_detail_position_X = MAX(_max_detail_position_X, _last_detail_position_X + detail_def->width);
-            }
-        }
-
-        //component instance location
-        transform.values[12] = MM2INCH(_last_detail_position_X);
-        transform.values[13] = MM2INCH(_last_detail_position_Y);
 
-        // Update _last_detail_position
-        if (_detail_position_direction == 0)
-        {
-            _last_detail_position_X += DISTANCE_X + detail_def->width;
+            // Erase drill hole instances from component
+            SU_CALL(SUEntitiesErase(instance_entities, holeCount, &elements[0]));
         }
-        else
+    }
+
+    if (rebuild)
+    {
+        // Create detail component
+        if (result->status != 0)
         {
-            _last_detail_position_Y += DISTANCE_Y + detail_def->height;
+            printf("Detail %d: geometry generation failed (%d)\n", detail_def->id, result->status);
         }
+        _create_detail_component(mc, instance_entities, detail_def, result->mesh);
+        _definition_hash_set(component, hash_str);
+    }
+    mc->shared.emplace(hash, component);
 
-        SU_CALL(SUComponentInstanceSetTransform(instance, &transform));
-        SU_CALL(SUEntitiesAddInstance(entities, instance, NULL));
+    _plan_detail(mc, component, detail_def);
+}
 
-        for (size_t i = componentNumInstancesCount+1; i < detail_def->amount; i++)
-        {
-            transform.values[14] = MM2INCH(i*detail_def->thickness * DISTANCE_Z);
+/* Index existing materials once per write_new_model(), first material wins for duplicate names */
+static void _material_index_build(MODEL_CTX_T *mc)
+{
+    size_t num_materials = 0;
+    SU_CALL(SUModelGetNumMaterials(mc->model, &num_materials));
+    if (num_materials == 0)
+    {
+        return;
+    }
 
-            SUComponentInstanceRef instance2 = SU_INVALID;
-            SU_CALL(SUComponentDefinitionCreateInstance(component, &instance2));
+    std::vector<SUMaterialRef> materials(num_materials);
+    SU_CALL(SUModelGetMaterials(mc->model, num_materials,
+                                &materials[0], &num_materials));
 
-            // Set the transformation
-            SU_CALL(SUComponentInstanceSetTransform(instance2, &transform));
-            SU_CALL(SUEntitiesAddInstance(entities, instance2, NULL));
-        }
-    }
-    else if (detail_def->amount < componentNumInstancesCount)
+    mc->materials.reserve(num_materials);
+    for (size_t i = 0; i < num_materials; i++)
     {
-        wprintf(L"TODO: need to remove some components instances (required %zd but %zd present)\n",
-                detail_def->amount, componentNumInstancesCount);
+        SUStringRef name = SU_INVALID;
+        SU_CALL(SUStringCreate(&name));
+        SU_CALL(SUMaterialGetName(materials[i], &name));
+        mc->materials.emplace(_su_string_to_utf8(name), materials[i]);
+        SU_CALL(SUStringRelease(&name));
     }
-
 }
 
-static void _add_update_material(SUModelRef model, SUMaterialRef *m_ptr, const char *m_name, SUColor *color)
+static void _add_update_material(MODEL_CTX_T *mc, SUMaterialRef *m_ptr, const char *m_name, SUColor *color)
 {
-    bool material_found = false;
-    size_t num_materials = 0;
     SUMaterialRef material = SU_INVALID;
-    SU_CALL(SUModelGetNumMaterials(model, &num_materials));
 
     // Find same materials in the model
-    if (num_materials > 0)
+    auto it = mc->materials.find(m_name);
+    if (it != mc->materials.end())
     {
-        std::vector<SUMaterialRef> materials(num_materials);
-        SU_CALL(SUModelGetMaterials(model, num_materials,
-                                    &materials[0], &num_materials));
-
-        for (size_t i = 0; (i < num_materials) && !material_found; i++)
-        {
-            material = materials[i];
+        material = it->second;
 
-            SUStringRef name = SU_INVALID;
-            SU_CALL(SUStringCreate(&name));
-            SU_CALL(SUMaterialGetName(material, &name));
-            size_t name_length = 0;
-            SU_CALL(SUStringGetUTF8Length(name, &name_length));
-            char* name_utf8 = new char[name_length + 1];
-            SU_CALL(SUStringGetUTF8(name, name_length + 1, name_utf8, &name_length));
-            // Now we have the name in a form we can use
-            SU_CALL(SUStringRelease(&name));
+        // Avoid redundant writes - they go to undo history and the saved file
+        SUColor old_color;
+        SUMaterialType old_type;
+        SU_CALL(SUMaterialGetColor(material, &old_color));
+        SU_CALL(SUMaterialGetType(material, &old_type));
 
-            material_found = (strcmp(m_name, name_utf8) == 0);
-            delete []name_utf8;
+        if ((old_color.red != color->red) || (old_color.green != color->green) ||
+            (old_color.blue != color->blue) || (old_color.alpha != color->alpha))
+        {
+            SU_CALL(SUMaterialSetColor(material, color));
         }
-    }
 
-    if (!material_found)
-    {
-        material = SU_INVALID;
-        SU_CALL(SUMaterialCreate(&material));
-        if (m_name != NULL)
+        if (old_type != SUMaterialType_Colored)
         {
-            SU_CALL(SUMaterialSetName(material, m_name));
+            SU_CALL(SUMaterialSetType(material, SUMaterialType_Colored));
         }
-        SU_CALL(SUModelAddMaterials(model, 1, &material));
     }
+    else
+    {
+        SU_CALL(SUMaterialCreate(&material));
+        SU_CALL(SUMaterialSetName(material, m_name));
+        SU_CALL(SUModelAddMaterials(mc->model, 1, &material));
+        SU_CALL(SUMaterialSetColor(material, color));
+        SU_CALL(SUMaterialSetType(material, SUMaterialType_Colored));
 
-    SU_CALL(SUMaterialSetColor(material, color));
-    SU_CALL(SUMaterialSetType(material, SUMaterialType_Colored));
+        mc->materials.emplace(m_name, material);
+    }
 
     *m_ptr = material;
 }
 
-int write_new_model(const WCHAR *model_filename)
+static int _materials_init(const VIYAR_PROJECT_T *project)
+{
+    SUmaterials = (SUMATERIAL_T*)malloc(project->materials_cnt * sizeof(SUmaterials[0]));
+    if ((SUmaterials == NULL) && (project->materials_cnt > 0))
+    {
+        return 1;
+    }
+    SUmaterials_cnt = project->materials_cnt;
+    memset(SUmaterials, 0, project->materials_cnt * sizeof(SUmaterials[0]));
+    for (size_t i = 0; i < SUmaterials_cnt; i++)
+    {
+        SUmaterials[i].mdef = &project->materials[i];
+    }
+
+    wprintf(L"_materials_cnt=%d\n", project->materials_cnt);
+    return 0;
+}
+
+/* Consumes details from queue while parser thread is still producing them */
+int write_new_model(const WCHAR *model_filename, DETAIL_QUEUE_T *queue, DRILL_STAT_T *drills, NEST_T *nest)
 {
     // Always initialize the API before using it
     SUInitialize();
@@ -859,6 +999,30 @@ int write_new_model(const WCHAR *model_filename)
         SU_CALL(SUModelCreate(&model));
     }
 
+    // Materials precede details in the project file, so they are complete
+    // once the first detail arrives (or parsing has finished)
+    DETAIL_DEF_T detail;
+    bool has_detail = detail_queue_pop(queue, &detail);
+
+    if (FAILED(detail_queue_status(queue)) || (_materials_init(&project) != 0))
+    {
+        if (has_detail)
+        {
+            detail_destroy(&detail);
+        }
+        detail_queue_close(queue, E_ABORT);
+        SU_CALL(SUModelRelease(&model));
+        SUTerminate();
+        return 1;
+    }
+
+    MODEL_CTX_T mc;
+    mc.model = model;
+    mc.project = &project;
+    mc.mesh = mesh_create();
+    SU_CALL(SUModelGetEntities(model, &mc.entities));
+    _material_index_build(&mc);
+
     //Add materials to the model and save them as materials[].material
     for (size_t i = 0; i < SUmaterials_cnt; i++)
     {
@@ -898,10 +1062,16 @@ int write_new_model(const WCHAR *model_filename)
                 color.green = 0;
                 color.blue = 102;
             }
+            else
+            {
+                color.red = 0;
+                color.green = 0;
+                color.blue = 0;
+            }
 
             char m_name[32];
             snprintf(m_name, sizeof(m_name), "kromka_%.1f", m->thickness);
-            _add_update_material(model, mref_ptr, m_name, &color);
+            _add_update_material(&mc, mref_ptr, m_name, &color);
         }
         else if (m->type == TYPE_SHEET)
         {
@@ -911,7 +1081,7 @@ int write_new_model(const WCHAR *model_filename)
             color.green = 255;
             color.blue = 255;
 
-            _add_update_material(model, mref_ptr, "Sheet", &color);
+            _add_update_material(&mc, mref_ptr, "Sheet", &color);
         }
         else
         {
@@ -919,14 +1089,46 @@ int write_new_model(const WCHAR *model_filename)
         }
     }
 
-    for (size_t i = 0; i < project.details_cnt; i++)
+    _component_index_build(&mc);
+
+    // Geometry is generated on all cores, SDK is called from this thread only
+    GEOM_POOL_T *pool = geom_pool_create(queue, has_detail ? &detail : NULL, &project, 0,
+                                         _detail_need_geometry, &mc);
+    try
     {
+        GEOM_RESULT_T result;
+        for (size_t i = 0; geom_pool_next(pool, &result); i++)
+        {
 #if 1
-        printf("Detail %zd:\n", i);
-        _dump_detail(&project.details[i]);
+            printf("Detail %zd:\n", i);
+            _dump_detail(&result.detail);
 #endif
-        _add_update_detail_components(model, &project.details[i]);
+            _add_update_detail_components(&mc, &result);
+            nest_add(nest, &result.detail, &project);
+            geom_pool_release(pool, &result);
+        }
     }
+    catch (...)
+    {
+        geom_pool_destroy(pool, NULL);
+        throw;
+    }
+    geom_pool_destroy(pool, drills);
+
+    mesh_destroy(mc.mesh);
+
+    // Do not save partially parsed project
+    if (FAILED(detail_queue_status(queue)))
+    {
+        wprintf(L"Project parsing failed - model is not saved.\n");
+        SU_CALL(SUModelRelease(&model));
+        SUTerminate();
+        return 1;
+    }
+
+    _reconcile_instances(&mc);
+
+    wprintf(L"_details_cnt=%d\n", project.details_cnt);
 
     // Save the in-memory model to a file
     SU_CALL(SUModelSaveToFile(model, (model_basename_utf8 + ".skp").c_str()));
@@ -941,9 +1143,56 @@ int write_new_model(const WCHAR *model_filename)
     return 0;
 }
 
+static HRESULT _cache_tee_cb(DETAIL_DEF_T *detail, const VIYAR_PROJECT_T *project, void *data)
+{
+    CACHE_TEE_T *tee = (CACHE_TEE_T *)data;
+
+    if (tee->writer && (project_cache_writer_add(tee->writer, detail) != 0))
+    {
+        // Cache is optional, conversion goes on without it
+        project_cache_writer_destroy(tee->writer);
+        tee->writer = NULL;
+    }
+    return detail_queue_cb(detail, project, tee->queue);
+}
+
+/* Details come from the binary cache next to the project file if the project
+ * did not change since the cache was written, otherwise the project is parsed
+ * and the cache rewritten. *cache has to stay open until all details are released */
+static HRESULT _load_project(const wchar_t *xmlfilename, DETAIL_QUEUE_T *queue, PROJECT_CACHE_T **cache)
+{
+    std::wstring cache_filename = std::wstring(xmlfilename) + PROJECT_CACHE_EXT;
+    unsigned long long key = 0;
+    bool has_key = (project_cache_key(xmlfilename, &key) == 0);
+
+    if (has_key)
+    {
+        *cache = project_cache_open(cache_filename.c_str(), key);
+        if (*cache)
+        {
+            wprintf(L"Using project cache %s\n", cache_filename.c_str());
+            return project_cache_stream(*cache, &project, detail_queue_cb, queue);
+        }
+    }
+
+    CACHE_TEE_T tee = { has_key ? project_cache_writer_create() : NULL, queue };
+    HRESULT hr = parse_xml_stream(xmlfilename, &project, _cache_tee_cb, &tee);
+    if (!FAILED(hr) && tee.writer)
+    {
+        if (project_cache_writer_save(tee.writer, &project, cache_filename.c_str(), key) != 0)
+        {
+            wprintf(L"Warning: can not write project cache %s\n", cache_filename.c_str());
+        }
+    }
+    project_cache_writer_destroy(tee.writer);
+    return hr;
+}
+
 int __cdecl wmain(int argc, _In_reads_(argc) WCHAR* argv[])
 {
     setlocale(LC_ALL, "");
+    // Component and material names embed sizes, they must not depend on the user's decimal separator
+    setlocale(LC_NUMERIC, "C");
     if (argc != 3)
     {
         wprintf(L"Usage: XmlLiteReader <viyar_project_file> <sketchup_model_file>\n");
@@ -951,39 +1200,56 @@ int __cdecl wmain(int argc, _In_reads_(argc) WCHAR* argv[])
         return 0;
     }
 
-    HRESULT hr = parse_xml(argv[1], &project);
+    DETAIL_QUEUE_T *queue = detail_queue_create(DETAIL_QUEUE_DEFAULT_CAPACITY);
 
-    if (FAILED(hr))
-    {
-        project_destroy(&project);
-        return hr;
-    }
+    // Parse details on a separate thread while the model is being built
+    HRESULT hr = S_OK;
+    PROJECT_CACHE_T *cache = NULL;
+    std::thread parser([&hr, &cache, queue, argv] {
+        hr = _load_project(argv[1], queue, &cache);
+        detail_queue_close(queue, hr);
+    });
 
-    SUmaterials = (SUMATERIAL_T*)malloc(project.materials_cnt * sizeof(SUmaterials[0]));
-    if (SUmaterials == NULL)
+    DRILL_STAT_T *drills = drill_create(DRILL_DEFAULT_TOLERANCE);
+    NEST_T *nest = nest_create(NULL);
+
+    int res;
+    try
     {
-        return 1;
+        res = write_new_model(argv[2], queue, drills, nest);
     }
-    SUmaterials_cnt = project.materials_cnt;
-    memset(SUmaterials, 0, project.materials_cnt * sizeof(SUmaterials[0]));
-    for (size_t i = 0; i < SUmaterials_cnt; i++)
+    catch (...)
     {
-        SUmaterials[i].mdef = &project.materials[i];
+        detail_queue_close(queue, E_ABORT);
+        parser.join();
+        throw;
     }
 
-    wprintf(L"_materials_cnt=%d, _details_cnt=%d\n", project.materials_cnt, project.details_cnt);
+    parser.join();
+    detail_queue_destroy(queue);
+    // Names of all details point into the cache, they are released by now
+    project_cache_close(cache);
 
-    drill_init();
-
-    int res = write_new_model(argv[2]);
+    if (FAILED(hr))
+    {
+        res = hr;
+    }
 
     project_destroy(&project);
     free(SUmaterials);
     SUmaterials = NULL;
     SUmaterials_cnt = 0;
 
-    drill_print_stat();
-    drill_deinit();
+    drill_print_stat(drills);
+    drill_destroy(drills);
+
+    // Yield estimate, the model is already saved
+    if (res == 0)
+    {
+        nest_run(nest);
+        nest_print(nest);
+    }
+    nest_destroy(nest);
 
     return res;
 }
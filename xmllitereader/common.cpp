@@ -1,11 +1,19 @@
 #include "common.h"
 
-//#include <ole2.h>
-//#include <xmllite.h>
 #include <stdio.h>
-#include <shlwapi.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 extern "C"
 {
 
@@ -73,4 +81,197 @@ void *array_find_element(ARRAY_T *a, element_cmp_fn cb, void *data)
     return NULL;
 }
 
+void arena_init(ARENA_T *a, size_t block_size)
+{
+    a->head = NULL;
+    a->block_size = block_size;
+}
+
+void *arena_alloc(ARENA_T *a, size_t size)
+{
+    size = ((size + ALLIGN_BYTES - 1) / ALLIGN_BYTES) * ALLIGN_BYTES;
+
+    if (a->block_size == 0)
+    {
+        a->block_size = ARENA_DEFAULT_BLOCK_SIZE;
+    }
+
+    ARENA_BLOCK_T *b = a->head;
+    if ((b == NULL) || (b->used + size > b->size))
+    {
+        size_t block_size = MAX(size, a->block_size);
+        b = (ARENA_BLOCK_T *)malloc(sizeof(ARENA_BLOCK_T) + block_size);
+        if (b == NULL)
+        {
+            return NULL;
+        }
+        b->used = 0;
+        b->size = block_size;
+
+        if ((block_size > a->block_size) && (a->head != NULL))
+        {
+            // Oversized allocation - keep current block for next allocations
+            b->next = a->head->next;
+            a->head->next = b;
+        }
+        else
+        {
+            b->next = a->head;
+            a->head = b;
+        }
+    }
+
+    void *ptr = (unsigned char *)(b + 1) + b->used;
+    b->used += size;
+    return ptr;
+}
+
+void arena_reset(ARENA_T *a)
+{
+    if (a->head == NULL)
+    {
+        return;
+    }
+
+    // Keep only the current block
+    ARENA_BLOCK_T *b = a->head->next;
+    while (b)
+    {
+        ARENA_BLOCK_T *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head->next = NULL;
+    a->head->used = 0;
+}
+
+void arena_free(ARENA_T *a)
+{
+    ARENA_BLOCK_T *b = a->head;
+    while (b)
+    {
+        ARENA_BLOCK_T *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+}
+
+void arena_merge(ARENA_T *dst, ARENA_T *src)
+{
+    if (src->head == NULL)
+    {
+        return;
+    }
+
+    if (dst->head == NULL)
+    {
+        dst->head = src->head;
+        dst->block_size = MAX(dst->block_size, src->block_size);
+    }
+    else
+    {
+        // Keep current block of dst for next allocations
+        ARENA_BLOCK_T *tail = src->head;
+        while (tail->next)
+        {
+            tail = tail->next;
+        }
+        tail->next = dst->head->next;
+        dst->head->next = src->head;
+    }
+    src->head = NULL;
+}
+
+int file_map(const wchar_t *filename, MAPPED_FILE_T *mf /* out */)
+{
+    memset(mf, 0, sizeof(*mf));
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return -1;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || (size.QuadPart == 0))
+    {
+        CloseHandle(file);
+        return -1;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        CloseHandle(file);
+        return -1;
+    }
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return -1;
+    }
+
+    mf->file = file;
+    mf->mapping = mapping;
+    mf->data = (const char *)data;
+    mf->size = (size_t)size.QuadPart;
+#else
+    char path[4096];
+    if (wcstombs(path, filename, sizeof(path)) >= sizeof(path))
+    {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    mf->data = (const char *)data;
+    mf->size = (size_t)st.st_size;
+#endif
+
+    return 0;
+}
+
+void file_unmap(MAPPED_FILE_T *mf)
+{
+    if (mf->data == NULL)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(mf->data);
+    CloseHandle((HANDLE)mf->mapping);
+    CloseHandle((HANDLE)mf->file);
+#else
+    munmap((void *)mf->data, mf->size);
+#endif
+
+    memset(mf, 0, sizeof(*mf));
+}
+
 } //extern "C"
@@ -1,5 +1,12 @@
 #pragma once
 
+#include <stddef.h>
+#include <wchar.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
 /***************************************************************/
 /*                     Global Definitions                      */
 /***************************************************************/
@@ -19,6 +26,17 @@
 #define SU_CALL(func) if ((func) != SU_ERROR_NONE) { printf("Error on Line %d\n", __LINE__); throw std::exception(); }
 #endif
 
+#ifndef _WIN32
+/* Minimal HRESULT subset so that parser code builds outside of Windows */
+typedef int HRESULT;
+#define S_OK        ((HRESULT)0)
+#define S_FALSE     ((HRESULT)1)
+#define E_ABORT     ((HRESULT)0x80004004L)
+#define FAILED(hr)  (((HRESULT)(hr)) < 0)
+#endif
+
+#define ARENA_DEFAULT_BLOCK_SIZE (64*1024)
+
 #define PARSE_FAIL(ret)                do { printf("PARSE_FAIL line %d\n", __LINE__); return (ret); } while(0)
 
 #define DISTANCE_X 50 //mm
@@ -58,6 +76,28 @@ typedef struct {
 
 typedef bool (*element_cmp_fn)(void *element, void *data);
 
+typedef struct ARENA_BLOCK {
+    struct ARENA_BLOCK *next;
+    size_t used;
+    size_t size;
+} ARENA_BLOCK_T;
+
+/* Bump allocator, everything is released at once with arena_free().
+ * Zero-initialized ARENA_T is a valid empty arena. */
+typedef struct {
+    ARENA_BLOCK_T *head;    //current block, older blocks are linked from it
+    size_t block_size;
+} ARENA_T;
+
+typedef struct {
+    const char *data;
+    size_t size;
+#ifdef _WIN32
+    void *file;
+    void *mapping;
+#endif
+} MAPPED_FILE_T;
+
 /***************************************************************/
 /*                  Function declarations                      */
 /***************************************************************/
@@ -69,4 +109,14 @@ size_t array_get_count(ARRAY_T *a);
 void array_free(ARRAY_T *a);
 void *array_find_element(ARRAY_T *a, element_cmp_fn cb, void *data);
 
+void arena_init(ARENA_T *a, size_t block_size);
+void *arena_alloc(ARENA_T *a, size_t size);
+void arena_reset(ARENA_T *a);
+void arena_free(ARENA_T *a);
+/* Move all blocks of src into dst, allocations of src stay valid and src becomes empty */
+void arena_merge(ARENA_T *dst, ARENA_T *src);
+
+int file_map(const wchar_t *filename, MAPPED_FILE_T *mf /* out */);
+void file_unmap(MAPPED_FILE_T *mf);
+
 } //extern "C"
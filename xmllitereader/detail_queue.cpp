@@ -0,0 +1,101 @@
+#include "detail_queue.h"
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/***************************************************************/
+/*                       Local Types                           */
+/***************************************************************/
+
+struct DETAIL_QUEUE {
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<DETAIL_DEF_T> items;
+    size_t capacity;
+    bool closed;
+    HRESULT status;
+};
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+DETAIL_QUEUE_T *detail_queue_create(size_t capacity)
+{
+    DETAIL_QUEUE_T *q = new DETAIL_QUEUE_T;
+    q->capacity = (capacity > 0) ? capacity : DETAIL_QUEUE_DEFAULT_CAPACITY;
+    q->closed = false;
+    q->status = S_OK;
+    return q;
+}
+
+void detail_queue_destroy(DETAIL_QUEUE_T *q)
+{
+    if (!q)
+    {
+        return;
+    }
+
+    // Release details never consumed
+    for (size_t i = 0; i < q->items.size(); i++)
+    {
+        detail_destroy(&q->items[i]);
+    }
+    delete q;
+}
+
+bool detail_queue_push(DETAIL_QUEUE_T *q, DETAIL_DEF_T *detail)
+{
+    std::unique_lock<std::mutex> guard(q->lock);
+    q->not_full.wait(guard, [q] { return (q->items.size() < q->capacity) || q->closed; });
+    if (q->closed)
+    {
+        // Consumer gave up
+        detail_destroy(detail);
+        return false;
+    }
+    q->items.push_back(*detail);
+    q->not_empty.notify_one();
+    return true;
+}
+
+bool detail_queue_pop(DETAIL_QUEUE_T *q, DETAIL_DEF_T *detail /* out */)
+{
+    std::unique_lock<std::mutex> guard(q->lock);
+    q->not_empty.wait(guard, [q] { return !q->items.empty() || q->closed; });
+    if (q->items.empty())
+    {
+        return false;
+    }
+
+    *detail = q->items.front();
+    q->items.pop_front();
+    q->not_full.notify_one();
+    return true;
+}
+
+void detail_queue_close(DETAIL_QUEUE_T *q, HRESULT status)
+{
+    std::lock_guard<std::mutex> guard(q->lock);
+    if (!q->closed)
+    {
+        q->status = status;
+    }
+    q->closed = true;
+    q->not_empty.notify_all();
+    q->not_full.notify_all();
+}
+
+HRESULT detail_queue_status(DETAIL_QUEUE_T *q)
+{
+    std::lock_guard<std::mutex> guard(q->lock);
+    return q->status;
+}
+
+HRESULT detail_queue_cb(DETAIL_DEF_T *detail, const VIYAR_PROJECT_T *project, void *data)
+{
+    (void)project;
+    return detail_queue_push((DETAIL_QUEUE_T *)data, detail) ? S_OK : E_ABORT;
+}
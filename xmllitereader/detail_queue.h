@@ -0,0 +1,38 @@
+#pragma once
+
+#include "viyar.h"
+
+/***************************************************************/
+/*                     Global Definitions                      */
+/***************************************************************/
+
+#define DETAIL_QUEUE_DEFAULT_CAPACITY 64
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+/* Bounded single producer / single consumer queue of parsed details */
+typedef struct DETAIL_QUEUE DETAIL_QUEUE_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+DETAIL_QUEUE_T *detail_queue_create(size_t capacity);
+void detail_queue_destroy(DETAIL_QUEUE_T *q);
+
+/* Blocks while queue is full. Queue takes ownership of detail content,
+ * returns false (and releases the detail) if queue was closed */
+bool detail_queue_push(DETAIL_QUEUE_T *q, DETAIL_DEF_T *detail);
+
+/* Blocks while queue is empty. Returns false when queue is closed and drained */
+bool detail_queue_pop(DETAIL_QUEUE_T *q, DETAIL_DEF_T *detail /* out */);
+
+/* Called by producer when parsing is done (status is parse result),
+ * or by consumer to stop the producer. First status wins */
+void detail_queue_close(DETAIL_QUEUE_T *q, HRESULT status);
+HRESULT detail_queue_status(DETAIL_QUEUE_T *q);
+
+/* detail_cb for parse_xml_stream(), data is DETAIL_QUEUE_T* */
+HRESULT detail_queue_cb(DETAIL_DEF_T *detail, const VIYAR_PROJECT_T *project, void *data);
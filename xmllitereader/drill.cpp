@@ -1,94 +1,220 @@
 #include "drill.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 
 extern "C"
 {
 
+#define DRILL_HASH_MIN_SIZE 64
+
+/* Canonical drill signature in fixed-point units of tolerance:
+ * two drills are the same type if their keys are equal */
+typedef struct {
+    int face;       //front/back vs edge sides
+    int through;    //depth is through depth (tdepth)
+    long long d;
+    long long depth;
+} DRILL_KEY_T;
+
 typedef struct {
-    DRILL_T dr;
+    DRILL_KEY_T key;
     size_t amount;
+    unsigned long long order; //first occurrence, see drill_append()
 } DRILL_ITEM_T;
 
-static ARRAY_T drarray;
+struct DRILL_STAT {
+    double tolerance;
+    ARRAY_T items;      //DRILL_ITEM_T in insertion order
+    size_t *hash;       //open addressing, position in items + 1, 0 = empty
+    size_t hash_size;   //power of 2
+};
 
-static bool drill_params_cmp_fn(void *element, void *data)
+static long long drill_quantize(const DRILL_STAT_T *ds, double value)
 {
-    DRILL_ITEM_T *item_ptr = (DRILL_ITEM_T *)element;
-    DRILL_ITEM_T *new_item_ptr = (DRILL_ITEM_T *)data;
+    return llround(value / ds->tolerance);
+}
 
-    //printf("compare d=%.1f to d=%.1f\n", item_ptr->dr.d, new_item_ptr->dr.d);
+static double drill_value(const DRILL_STAT_T *ds, long long q)
+{
+    return q * ds->tolerance;
+}
 
-    if (((item_ptr->dr.side == SIDE_FRONT) || (item_ptr->dr.side == SIDE_BACK)) &&
-        ((new_item_ptr->dr.side != SIDE_FRONT) && (new_item_ptr->dr.side != SIDE_BACK)))
-    {
-        return false;
-    }
+static DRILL_KEY_T drill_key(const DRILL_STAT_T *ds, const DRILL_T *dr)
+{
+    DRILL_KEY_T key;
+    key.face = (dr->side == SIDE_FRONT) || (dr->side == SIDE_BACK);
+    key.d = drill_quantize(ds, dr->d);
+    //depth only matters for blind drills
+    key.through = (drill_quantize(ds, dr->tdepth) != 0);
+    key.depth = drill_quantize(ds, key.through ? dr->tdepth : dr->depth);
+    return key;
+}
 
-    if (((new_item_ptr->dr.side == SIDE_FRONT) || (new_item_ptr->dr.side == SIDE_BACK)) &&
-        ((item_ptr->dr.side != SIDE_FRONT) && (item_ptr->dr.side != SIDE_BACK)))
-    {
-        return false;
-    }
+static bool drill_key_eq(const DRILL_KEY_T *a, const DRILL_KEY_T *b)
+{
+    return (a->d == b->d) && (a->depth == b->depth) && (a->face == b->face) && (a->through == b->through);
+}
 
-    //Compare diameter first
-    if (item_ptr->dr.d == new_item_ptr->dr.d)
+static size_t drill_key_hash(const DRILL_KEY_T *key)
+{
+    unsigned long long h = (unsigned long long)key->d * 0x9E3779B97F4A7C15ULL;
+    h ^= (unsigned long long)key->depth + 0x7F4A7C15ULL + (h << 6) + (h >> 2);
+    h ^= (unsigned long long)((key->face << 1) | key->through) * 0xC2B2AE3D27D4EB4FULL;
+    return (size_t)(h ^ (h >> 29));
+}
+
+static size_t *drill_hash_slot(DRILL_STAT_T *ds, const DRILL_KEY_T *key)
+{
+    size_t mask = ds->hash_size - 1;
+    size_t i = drill_key_hash(key) & mask;
+
+    for (;;)
     {
-        if ((item_ptr->dr.tdepth == 0) && (new_item_ptr->dr.tdepth == 0))
+        if (ds->hash[i] == 0)
         {
-            //return if depth is equal and both tdepth are zero
-            return (item_ptr->dr.depth == new_item_ptr->dr.depth);
+            return &ds->hash[i];
         }
-        else
+
+        DRILL_ITEM_T *item_ptr = (DRILL_ITEM_T *)array_get_element(&ds->items, ds->hash[i] - 1);
+        if (drill_key_eq(&item_ptr->key, key))
         {
-            //return if tdepth is non zero and equal
-            return (item_ptr->dr.tdepth == new_item_ptr->dr.tdepth);
+            return &ds->hash[i];
         }
-    }
 
-    return false;
+        i = (i + 1) & mask;
+    }
 }
 
-void drill_init(void)
+static void drill_hash_rebuild(DRILL_STAT_T *ds, size_t size)
 {
-    array_init(&drarray, sizeof(DRILL_ITEM_T));
+    free(ds->hash);
+    ds->hash = (size_t *)calloc(size, sizeof(size_t));
+    ds->hash_size = size;
+
+    for (size_t i = 0; i < array_get_count(&ds->items); i++)
+    {
+        DRILL_ITEM_T *item_ptr = (DRILL_ITEM_T *)array_get_element(&ds->items, i);
+        *drill_hash_slot(ds, &item_ptr->key) = i + 1;
+    }
 }
 
-void drill_append(const DRILL_T *dr, size_t amount)
+static void drill_add_item(DRILL_STAT_T *ds, const DRILL_KEY_T *key, size_t amount, unsigned long long order)
 {
+    size_t *slot = drill_hash_slot(ds, key);
+
+    if (*slot)
+    {
+        DRILL_ITEM_T *item_ptr = (DRILL_ITEM_T *)array_get_element(&ds->items, *slot - 1);
+        item_ptr->amount += amount;
+        item_ptr->order = MIN(item_ptr->order, order);
+        return;
+    }
+
     DRILL_ITEM_T item;
-    DRILL_ITEM_T *item_ptr;
-    item.dr = *dr;
+    item.key = *key;
     item.amount = amount;
+    item.order = order;
+    array_insert(&ds->items, &item);
+    *slot = array_get_count(&ds->items);
 
-    item_ptr = (DRILL_ITEM_T *)array_find_element(&drarray, drill_params_cmp_fn, &item);
-    if (item_ptr)
+    //Keep load factor below 1/2
+    if (array_get_count(&ds->items) * 2 > ds->hash_size)
     {
-        item_ptr->amount += amount;
+        drill_hash_rebuild(ds, ds->hash_size * 2);
     }
-    else
+}
+
+static int drill_order_cmp_fn(const void *a, const void *b)
+{
+    const DRILL_ITEM_T *item_a = *(const DRILL_ITEM_T * const *)a;
+    const DRILL_ITEM_T *item_b = *(const DRILL_ITEM_T * const *)b;
+
+    if (item_a->order != item_b->order)
+    {
+        return (item_a->order < item_b->order) ? -1 : 1;
+    }
+    return (item_a < item_b) ? -1 : (item_a > item_b);
+}
+
+DRILL_STAT_T *drill_create(double tolerance)
+{
+    DRILL_STAT_T *ds = (DRILL_STAT_T *)calloc(1, sizeof(DRILL_STAT_T));
+    if (ds == NULL)
+    {
+        return NULL;
+    }
+
+    ds->tolerance = (tolerance > 0) ? tolerance : DRILL_DEFAULT_TOLERANCE;
+    array_init(&ds->items, sizeof(DRILL_ITEM_T));
+    drill_hash_rebuild(ds, DRILL_HASH_MIN_SIZE);
+    return ds;
+}
+
+void drill_append(DRILL_STAT_T *ds, const DRILL_T *dr, size_t amount, unsigned long long order)
+{
+    DRILL_KEY_T key = drill_key(ds, dr);
+    drill_add_item(ds, &key, amount, order);
+}
+
+int drill_merge(DRILL_STAT_T *dst, const DRILL_STAT_T *src)
+{
+    if (dst->tolerance != src->tolerance)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < array_get_count((ARRAY_T *)&src->items); i++)
     {
-        printf("insert d=%.1f, depth=%.1f, tdepth=%.1f\n", item.dr.d, item.dr.depth, item.dr.tdepth);
-        array_insert(&drarray, &item);
+        DRILL_ITEM_T *item_ptr = (DRILL_ITEM_T *)array_get_element((ARRAY_T *)&src->items, i);
+        drill_add_item(dst, &item_ptr->key, item_ptr->amount, item_ptr->order);
     }
+    return 0;
 }
 
-void drill_print_stat(void)
+void drill_print_stat(const DRILL_STAT_T *ds)
 {
-    printf("array_get_count() = %zd\n", array_get_count(&drarray));
+    ARRAY_T *items = (ARRAY_T *)&ds->items;
+    size_t count = array_get_count(items);
+
+    //Print in order of first occurrence, independent of how stats were merged
+    DRILL_ITEM_T **sorted = (DRILL_ITEM_T **)malloc(MAX(count, 1) * sizeof(DRILL_ITEM_T *));
+    if (sorted == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        sorted[i] = (DRILL_ITEM_T *)array_get_element(items, i);
+    }
+    qsort(sorted, count, sizeof(sorted[0]), drill_order_cmp_fn);
+
+    printf("array_get_count() = %zd\n", count);
     size_t total_drill_cnt = 0;
-    for (size_t i = 0; i < array_get_count(&drarray); i++)
+    for (size_t i = 0; i < count; i++)
     {
-        DRILL_ITEM_T *item_ptr = (DRILL_ITEM_T *)array_get_element(&drarray, i);
-        printf("drill_type %3zd: d=%.1f, depth=%.1f, tdepth=%.1f, amount=%zd\n", i, item_ptr->dr.d, item_ptr->dr.depth, item_ptr->dr.tdepth, item_ptr->amount);
+        DRILL_ITEM_T *item_ptr = sorted[i];
+        double d = drill_value(ds, item_ptr->key.d);
+        double depth = item_ptr->key.through ? 0 : drill_value(ds, item_ptr->key.depth);
+        double tdepth = item_ptr->key.through ? drill_value(ds, item_ptr->key.depth) : 0;
+        printf("drill_type %3zd: d=%.1f, depth=%.1f, tdepth=%.1f, amount=%zd\n", i, d, depth, tdepth, item_ptr->amount);
         total_drill_cnt += item_ptr->amount;
     }
 
     printf("total drill count: %zd\n", total_drill_cnt);
+    free(sorted);
 }
 
-void drill_deinit(void)
+void drill_destroy(DRILL_STAT_T *ds)
 {
-    array_free(&drarray);
+    if (ds == NULL)
+    {
+        return;
+    }
+
+    array_free(&ds->items);
+    free(ds->hash);
+    free(ds);
 }
 
 } //extern "C"
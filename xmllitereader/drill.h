@@ -6,6 +6,14 @@
 /*                     Global Definitions                      */
 /***************************************************************/
 
+#define DRILL_DEFAULT_TOLERANCE 0.01 //mm
+
+/* Processing order of drilling op_index on side of detail with detail_id and
+ * operations_cnt operations: details in project order, within a detail sides
+ * in SIDE_ order and operations in project order on each side */
+#define DRILL_ORDER(detail_id, side, op_index, operations_cnt) \
+    (((unsigned long long)(detail_id) << 32) | ((unsigned long long)(side) * (operations_cnt) + (op_index)))
+
 /***************************************************************/
 /*                       Global Types                          */
 /***************************************************************/
@@ -22,13 +30,26 @@ typedef struct {
     int side;
 } DRILL_T;
 
+/* Drill statistics accumulator. Not thread-safe: use one per worker thread
+ * and combine them with drill_merge() */
+typedef struct DRILL_STAT DRILL_STAT_T;
+
 /***************************************************************/
 /*                  Function definitions                       */
 /***************************************************************/
 
-void drill_init(void);
-void drill_append(const DRILL_T *dr, size_t amount);
-void drill_print_stat(void);
-void drill_deinit(void);
+/* Drill parameters are quantized to multiples of tolerance (mm) before
+ * grouping, tolerance <= 0 selects DRILL_DEFAULT_TOLERANCE */
+DRILL_STAT_T *drill_create(double tolerance);
+
+/* order is position of the drill in single-threaded processing order
+ * (see DRILL_ORDER), drill types are printed in order of first occurrence */
+void drill_append(DRILL_STAT_T *ds, const DRILL_T *dr, size_t amount, unsigned long long order);
+
+/* Add src statistics to dst, result does not depend on merge order */
+int drill_merge(DRILL_STAT_T *dst, const DRILL_STAT_T *src);
+
+void drill_print_stat(const DRILL_STAT_T *ds);
+void drill_destroy(DRILL_STAT_T *ds);
 
 } //extern "C"
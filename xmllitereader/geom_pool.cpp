@@ -0,0 +1,266 @@
+#include "geom_pool.h"
+
+#include <stdio.h>
+
+#include <map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+/***************************************************************/
+/*                       Local Types                           */
+/***************************************************************/
+
+struct GEOM_POOL {
+    DETAIL_QUEUE_T *queue;
+    const VIYAR_PROJECT_T *project;
+    geom_need_cb need;
+    void *data;
+
+    std::vector<std::thread> workers;
+    std::vector<DRILL_STAT_T *> drills; //per worker
+
+    std::mutex input_lock; //pop and sequence number are taken together
+    DETAIL_DEF_T first;
+    bool has_first;
+    size_t next_seq;
+
+    std::mutex lock;
+    std::condition_variable result_ready;
+    std::condition_variable window_open;
+    std::map<size_t, GEOM_RESULT_T> results; //by sequence number
+    std::unordered_map<unsigned long long, size_t> claimed; //lowest sequence number building geometry, by hash
+    std::vector<MESH_T *> free_meshes;
+    size_t next_commit;
+    size_t window;
+    size_t running;
+    bool stop;
+};
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+static bool _pool_take(GEOM_POOL_T *pool, DETAIL_DEF_T *detail, size_t *seq)
+{
+    std::lock_guard<std::mutex> guard(pool->input_lock);
+    if (pool->has_first)
+    {
+        *detail = pool->first;
+        pool->has_first = false;
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> state(pool->lock);
+            if (pool->stop)
+            {
+                return false;
+            }
+        }
+        if (!detail_queue_pop(pool->queue, detail))
+        {
+            return false;
+        }
+    }
+    *seq = pool->next_seq++;
+    return true;
+}
+
+static void _pool_worker(GEOM_POOL_T *pool, DRILL_STAT_T *drills)
+{
+    DETAIL_DEF_T detail;
+    size_t seq;
+
+    while (_pool_take(pool, &detail, &seq))
+    {
+        GEOM_RESULT_T result;
+        result.detail = detail;
+        result.hash = detail_hash(&detail, pool->project);
+        result.mesh = NULL;
+        result.status = 0;
+
+        bool claim = false;
+        {
+            std::unique_lock<std::mutex> guard(pool->lock);
+            pool->window_open.wait(guard, [pool, seq] { return (seq < pool->next_commit + pool->window) || pool->stop; });
+            if (pool->stop)
+            {
+                detail_destroy(&result.detail);
+                break;
+            }
+
+            // Identical details share geometry, the first one in queue order builds it:
+            // the committer reaches it before the duplicates
+            auto claimed = pool->claimed.find(result.hash);
+            if ((detail.amount > 0) && ((claimed == pool->claimed.end()) || (seq < claimed->second)))
+            {
+                claim = !pool->need || pool->need(&detail, result.hash, pool->data);
+                if (claim)
+                {
+                    pool->claimed[result.hash] = seq;
+                    if (!pool->free_meshes.empty())
+                    {
+                        result.mesh = pool->free_meshes.back();
+                        pool->free_meshes.pop_back();
+                    }
+                }
+            }
+        }
+
+        // Details without instances do not count, as in the committer
+        for (size_t j = 0; (detail.amount > 0) && (j < detail.operations_cnt); j++)
+        {
+            DRILL_T dr;
+            if (geom_detail_drill(&detail, &detail.operations[j], &dr))
+            {
+                drill_append(drills, &dr, detail.amount, DRILL_ORDER(detail.id, dr.side, j, detail.operations_cnt));
+            }
+        }
+
+        if (claim)
+        {
+            if (result.mesh == NULL)
+            {
+                result.mesh = mesh_create();
+            }
+            mesh_reset(result.mesh);
+            GEOM_SINK_T sink = mesh_sink(result.mesh, true);
+            result.status = geom_detail(&detail, pool->project, &sink);
+        }
+
+        std::lock_guard<std::mutex> guard(pool->lock);
+        if (claim && (pool->claimed[result.hash] != seq))
+        {
+            // An earlier duplicate took the claim over while this one was built
+            pool->free_meshes.push_back(result.mesh);
+            result.mesh = NULL;
+            result.status = 0;
+        }
+        pool->results[seq] = result;
+        pool->result_ready.notify_all();
+    }
+
+    std::lock_guard<std::mutex> guard(pool->lock);
+    pool->running--;
+    pool->result_ready.notify_all();
+}
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+GEOM_POOL_T *geom_pool_create(DETAIL_QUEUE_T *queue, DETAIL_DEF_T *first,
+                              const VIYAR_PROJECT_T *project, size_t num_workers,
+                              geom_need_cb need, void *data)
+{
+    if (num_workers == 0)
+    {
+        num_workers = MAX(std::thread::hardware_concurrency(), 1u);
+    }
+
+    GEOM_POOL_T *pool = new GEOM_POOL_T;
+    pool->queue = queue;
+    pool->project = project;
+    pool->need = need;
+    pool->data = data;
+    pool->has_first = (first != NULL);
+    if (first)
+    {
+        pool->first = *first;
+    }
+    pool->next_seq = 0;
+    pool->next_commit = 0;
+    pool->window = num_workers * GEOM_POOL_WINDOW;
+    pool->running = num_workers;
+    pool->stop = false;
+
+    for (size_t i = 0; i < num_workers; i++)
+    {
+        pool->drills.push_back(drill_create(DRILL_DEFAULT_TOLERANCE));
+    }
+    for (size_t i = 0; i < num_workers; i++)
+    {
+        pool->workers.emplace_back(_pool_worker, pool, pool->drills[i]);
+    }
+    return pool;
+}
+
+bool geom_pool_next(GEOM_POOL_T *pool, GEOM_RESULT_T *result)
+{
+    std::unique_lock<std::mutex> guard(pool->lock);
+    pool->result_ready.wait(guard, [pool] {
+        return (pool->results.count(pool->next_commit) > 0) || (pool->running == 0) || pool->stop; });
+
+    auto it = pool->results.find(pool->next_commit);
+    if (it == pool->results.end())
+    {
+        return false;
+    }
+
+    *result = it->second;
+    pool->results.erase(it);
+    pool->next_commit++;
+    pool->window_open.notify_all();
+    return true;
+}
+
+void geom_pool_release(GEOM_POOL_T *pool, GEOM_RESULT_T *result)
+{
+    detail_destroy(&result->detail);
+    if (result->mesh)
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->free_meshes.push_back(result->mesh);
+        result->mesh = NULL;
+    }
+}
+
+void geom_pool_destroy(GEOM_POOL_T *pool, DRILL_STAT_T *drills)
+{
+    if (!pool)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->stop = true;
+        pool->window_open.notify_all();
+    }
+    // Wake workers blocked in detail_queue_pop(), no-op if parsing has finished
+    detail_queue_close(pool->queue, E_ABORT);
+    for (size_t i = 0; i < pool->workers.size(); i++)
+    {
+        pool->workers[i].join();
+    }
+
+    // Results never committed
+    for (auto it = pool->results.begin(); it != pool->results.end(); ++it)
+    {
+        GEOM_RESULT_T *result = &it->second;
+        detail_destroy(&result->detail);
+        mesh_destroy(result->mesh);
+    }
+    if (pool->has_first)
+    {
+        detail_destroy(&pool->first);
+    }
+
+    for (size_t i = 0; i < pool->drills.size(); i++)
+    {
+        if (drills)
+        {
+            drill_merge(drills, pool->drills[i]);
+        }
+        drill_destroy(pool->drills[i]);
+    }
+
+    for (size_t i = 0; i < pool->free_meshes.size(); i++)
+    {
+        mesh_destroy(pool->free_meshes[i]);
+    }
+    delete pool;
+}
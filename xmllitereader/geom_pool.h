@@ -0,0 +1,52 @@
+#pragma once
+
+#include "detail_queue.h"
+#include "mesh.h"
+
+/***************************************************************/
+/*                     Global Definitions                      */
+/***************************************************************/
+
+/* Results a worker may run ahead of the committer, per worker */
+#define GEOM_POOL_WINDOW 4
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+typedef struct {
+    DETAIL_DEF_T detail;
+    unsigned long long hash; //detail_hash()
+    MESH_T *mesh; //NULL if geometry was not needed, holes are instanced
+    int status; //geom_detail() result
+} GEOM_RESULT_T;
+
+/* Called from worker threads (must be thread-safe): false if the detail does
+ * not need new geometry, e.g. it is already up to date in the model */
+typedef bool (*geom_need_cb)(const DETAIL_DEF_T *detail, unsigned long long hash, void *data);
+
+/* Worker pool generating detail geometry off the committer thread.
+ * Results come out in queue order, so the model is built deterministically */
+typedef struct GEOM_POOL GEOM_POOL_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+/* first is a detail already taken from queue (NULL if none), it is processed first.
+ * Of identical details (equal hash) only the first in queue order that needs
+ * geometry gets it, so the committer never has to build it itself.
+ * num_workers == 0 selects number of cores */
+GEOM_POOL_T *geom_pool_create(DETAIL_QUEUE_T *queue, DETAIL_DEF_T *first,
+                              const VIYAR_PROJECT_T *project, size_t num_workers,
+                              geom_need_cb need, void *data);
+
+/* Blocks for the next result in queue order, false when all details are done */
+bool geom_pool_next(GEOM_POOL_T *pool, GEOM_RESULT_T *result /* out */);
+
+/* Release detail and return mesh to the pool */
+void geom_pool_release(GEOM_POOL_T *pool, GEOM_RESULT_T *result);
+
+/* Stops and joins workers, closing the queue with E_ABORT if still open. Per-worker drill statistics (collected for every
+ * detail, with DRILL_ORDER) are merged into drills unless it is NULL */
+void geom_pool_destroy(GEOM_POOL_T *pool, DRILL_STAT_T *drills);
@@ -0,0 +1,283 @@
+#include "geometry.h"
+#include "outline.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/***************************************************************/
+/*                     Local Definitions                       */
+/***************************************************************/
+
+#define GEOM_CALL(stmt)  do { int _res = (stmt); if (_res < 0) return _res; } while(0)
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+/* Hole axis: center on the surface and center of the bottom (axis[0], axis[1]) */
+static void _drill_axis(const GEOM_POINT_T *center, const GEOM_POINT_T *normal, const DRILL_T *dr, GEOM_POINT_T *axis)
+{
+    double DEPTH = (dr->tdepth > 0) ? dr->tdepth : dr->depth;
+
+    axis[0] = *center;
+    axis[1].x = center->x + normal->x*DEPTH;
+    axis[1].y = center->y + normal->y*DEPTH;
+    axis[1].z = center->z + normal->z*DEPTH;
+}
+
+/* Circles at both ends of num_holes holes in one batch, then their axes.
+ * axes holds 2 points per hole, see _drill_axis() */
+static int _drill_geometry(const GEOM_SINK_T *sink, const GEOM_POINT_T *axes, const double *r,
+                           size_t num_holes, const GEOM_POINT_T *normal)
+{
+    GEOM_CALL(sink->circles(sink->data, axes, r, 2 * num_holes, normal, GEOM_CIRCLE_SEGMENTS));
+
+    for (size_t i = 0; i < num_holes; i++)
+    {
+        GEOM_CALL(sink->edge(sink->data, &axes[2*i], &axes[2*i + 1]));
+    }
+    return 0;
+}
+
+static GEOM_POINT_T _detail_drill_center(GEOM_POINT_T corner, const DRILL_T *dr)
+{
+    GEOM_POINT_T center = corner;
+
+    if ((dr->side == SIDE_TOP) || (dr->side == SIDE_BOTTOM))
+    {
+        center.z -= dr->y;
+    }
+    else
+    {
+        center.y += dr->y;
+    }
+
+    if ((dr->side == SIDE_LEFT) || (dr->side == SIDE_RIGHT))
+    {
+        center.z -= dr->x;
+    }
+    else
+    {
+        center.x += dr->x;
+    }
+    return center;
+}
+
+/* Drill holes of one detail side, circles are tessellated GEOM_CIRCLE_BATCH holes at a time */
+static int _detail_side_drills(const GEOM_SINK_T *sink, const DETAIL_DEF_T *d, int side,
+                               GEOM_POINT_T corner, const GEOM_POINT_T *normal)
+{
+    GEOM_POINT_T axes[2 * GEOM_CIRCLE_BATCH];
+    double r[2 * GEOM_CIRCLE_BATCH];
+    size_t num_holes = 0;
+
+    for (size_t j = 0; j < d->operations_cnt; j++)
+    {
+        DRILL_T dr;
+        if (!geom_detail_drill(d, &d->operations[j], &dr) || (dr.side != side))
+        {
+            continue;
+        }
+
+        GEOM_POINT_T center = _detail_drill_center(corner, &dr);
+        _drill_axis(&center, normal, &dr, &axes[2 * num_holes]);
+        r[2 * num_holes] = r[2 * num_holes + 1] = dr.d/2;
+        num_holes++;
+
+        if (num_holes == GEOM_CIRCLE_BATCH)
+        {
+            GEOM_CALL(_drill_geometry(sink, axes, r, num_holes, normal));
+            num_holes = 0;
+        }
+    }
+
+    if (num_holes > 0)
+    {
+        GEOM_CALL(_drill_geometry(sink, axes, r, num_holes, normal));
+    }
+    return 0;
+}
+
+/* Front, back and band faces of the sheet extruded from outline */
+static int _detail_sheet(const GEOM_SINK_T *sink, const DETAIL_DEF_T *d, OUTLINE_T *outline, double Z)
+{
+    GEOM_POINT_T *sheet_points = outline->points;
+    size_t num_sheet_points = outline->count;
+
+    for (size_t j = 0 ; j < num_sheet_points; j++)
+    {
+        sheet_points[j].z = Z;
+    }
+
+    int material = d->m_bands[SIDE_FRONT];
+    GEOM_CALL(sink->face(sink->data, sheet_points, num_sheet_points, material));
+
+    for (size_t j = 0 ; j < num_sheet_points ; j++)
+    {
+        GEOM_POINT_T points[4];
+
+        points[0] = sheet_points[j];
+        points[1] = sheet_points[(j+1) % num_sheet_points];
+        points[2] = points[1];
+        points[2].z = 0;
+        points[3] = points[0];
+        points[3].z = 0;
+
+        GEOM_CALL(sink->face(sink->data, points, 4, outline->materials[j]));
+    }
+
+    //Back side keeps front material if it has no own
+    if (d->m_bands[SIDE_BACK])
+    {
+        material = d->m_bands[SIDE_BACK];
+    }
+
+    for (size_t j = 0 ; j < num_sheet_points; j++)
+    {
+        sheet_points[j].z = 0;
+    }
+
+    return sink->face(sink->data, sheet_points, num_sheet_points, material);
+}
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+bool geom_detail_drill(const DETAIL_DEF_T *d, const OPERATION_T *op, DRILL_T *dr)
+{
+    int i = op->side - 1;
+    if ((op->type != TYPE_DRILLING) || (i < 0) || (i >= 6))
+    {
+        return false;
+    }
+
+    dr->d = op->d;
+    dr->x = op->x;
+    dr->y = op->y;
+    dr->depth = op->depth;
+    dr->tdepth = 0;
+    dr->side = i;
+
+    if (((i == SIDE_FRONT) || (i == SIDE_BACK))
+            && (dr->depth > d->thickness))
+    {
+        dr->tdepth = d->thickness;
+    }
+    return true;
+}
+
+void geom_circle_start(const GEOM_POINT_T *center, const GEOM_POINT_T *normal, double r, GEOM_POINT_T *start)
+{
+    *start = *center;
+
+    //Holes on left/right sides start along z, all others along x
+    if (fabs(normal->x) > 0.5)
+    {
+        start->z += r;
+    }
+    else
+    {
+        start->x += r;
+    }
+}
+
+int geom_drill_hole(const DRILL_T *dr, const GEOM_SINK_T *sink)
+{
+    GEOM_POINT_T center = {0, 0, 0};
+    GEOM_POINT_T normal = {0, 0, 1};
+    GEOM_POINT_T axis[2];
+    double r[2] = {dr->d/2, dr->d/2};
+
+    _drill_axis(&center, &normal, dr, axis);
+    return _drill_geometry(sink, axis, r, 1, &normal);
+}
+
+int geom_detail(const DETAIL_DEF_T *d, const VIYAR_PROJECT_T *project, const GEOM_SINK_T *sink)
+{
+    //End coordinates of detail in mm
+    double X = (d->width);
+    double Y = (d->height);
+    double Z = (d->thickness);
+
+    GEOM_POINT_T sides[6][4] = {
+        {   //SIDE_FRONT
+            { 0, 0, Z },
+            { 0, Y, Z },
+            { X, Y, Z },
+            { X, 0, Z },
+        },
+        {   //SIDE_LEFT
+            { 0, 0, Z },
+            { 0, Y, Z },
+            { 0, Y, 0 },
+            { 0, 0, 0 },
+        },
+        {   //SIDE_TOP
+            { 0, Y, Z },
+            { X, Y, Z },
+            { X, Y, 0 },
+            { 0, Y, 0 },
+        },
+        {   //SIDE_RIGHT
+            { X, 0, Z },
+            { X, 0, 0 },
+            { X, Y, 0 },
+            { X, Y, Z },
+        },
+        {   //SIDE_BOTTOM
+            { 0, 0, Z },
+            { 0, 0, 0 },
+            { X, 0, 0 },
+            { X, 0, Z },
+        },
+        {   //SIDE_BACK
+            { 0, 0, 0 },
+            { 0, Y, 0 },
+            { X, Y, 0 },
+            { X, 0, 0 },
+        },
+    };
+
+    GEOM_POINT_T normals[6] = {
+        { 0,  0, -1},  //SIDE_FRONT
+        { 1,  0,  0},  //SIDE_LEFT
+        { 0, -1,  0},  //SIDE_TOP
+        {-1,  0,  0},  //SIDE_RIGHT
+        { 0,  1,  0},  //SIDE_BOTTOM
+        { 0,  0,  1},  //SIDE_BACK
+    };
+
+    OUTLINE_T outline;
+    outline_init(&outline);
+    if (outline_build(&outline, d, project, OUTLINE_DEFAULT_CHORD_TOLERANCE) < 0)
+    {
+        outline_free(&outline);
+        return -1;
+    }
+
+    int res = _detail_sheet(sink, d, &outline, Z);
+    outline_free(&outline);
+    GEOM_CALL(res);
+
+    if (sink->hole)
+    {
+        for (size_t j = 0; j < d->operations_cnt; j++)
+        {
+            DRILL_T dr;
+            if (geom_detail_drill(d, &d->operations[j], &dr))
+            {
+                GEOM_POINT_T center = _detail_drill_center(sides[dr.side][0], &dr);
+                GEOM_CALL(sink->hole(sink->data, &center, &normals[dr.side], &dr));
+            }
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < 6; i++)
+    {
+        GEOM_CALL(_detail_side_drills(sink, d, i, sides[i][0], &normals[i]));
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "viyar.h"
+#include "drill.h"
+
+/***************************************************************/
+/*                     Global Definitions                      */
+/***************************************************************/
+
+#define GEOM_CIRCLE_SEGMENTS 16
+
+/* Most drill holes of one panel side passed to GEOM_SINK_T.circles() at once */
+#define GEOM_CIRCLE_BATCH 32
+
+/* Stored with detail hash in the model, bump when generated geometry
+ * changes for the same detail so existing models get rebuilt */
+#define GEOM_VERSION 2
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+/* Coordinates are in mm, in the detail coordinate system */
+typedef struct {
+    double x;
+    double y;
+    double z;
+} GEOM_POINT_T;
+
+/* Geometry backend. Callbacks return negative value to abort generation;
+ * material_id is 1-based project material, 0 for none.
+ * circles gets num_circles circles in planes with the same normal (both ends of
+ * drill holes on one panel side), so the plane is set up once per batch.
+ * hole is optional: when set, drill holes are passed as a whole (hole axis
+ * starts at center and goes along normal into the detail) instead of being
+ * emitted as circles and an edge */
+typedef struct {
+    int (*face)(void *data, const GEOM_POINT_T *points, size_t num_points, int material_id);
+    int (*circles)(void *data, const GEOM_POINT_T *centers, const double *r, size_t num_circles,
+                   const GEOM_POINT_T *normal, size_t num_segments);
+    int (*edge)(void *data, const GEOM_POINT_T *start, const GEOM_POINT_T *end);
+    int (*hole)(void *data, const GEOM_POINT_T *center, const GEOM_POINT_T *normal, const DRILL_T *dr);
+    void *data;
+} GEOM_SINK_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+/* Fill dr for drilling operation, false if op is not a valid drilling */
+bool geom_detail_drill(const DETAIL_DEF_T *d, const OPERATION_T *op, DRILL_T *dr /* out */);
+
+/* First vertex of circle tessellation, same convention as SketchUp drill arcs */
+void geom_circle_start(const GEOM_POINT_T *center, const GEOM_POINT_T *normal, double r, GEOM_POINT_T *start /* out */);
+
+/* Emit single drill hole in its own coordinate system: axis from origin along +z */
+int geom_drill_hole(const DRILL_T *dr, const GEOM_SINK_T *sink);
+
+/* Emit sheet faces with corner operations, band faces and drill holes of detail.
+ * project supplies band material thickness for corner operations */
+int geom_detail(const DETAIL_DEF_T *d, const VIYAR_PROJECT_T *project, const GEOM_SINK_T *sink);
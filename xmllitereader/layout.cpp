@@ -0,0 +1,144 @@
+#include "layout.h"
+
+#include <math.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+/***************************************************************/
+/*                       Local Types                           */
+/***************************************************************/
+
+typedef struct {
+    double width;
+    double height;
+    double x;
+    double y;
+} LAYOUT_ITEM_T;
+
+struct LAYOUT {
+    double spacing_x;
+    double spacing_y;
+    double width;
+    double height;
+    std::vector<LAYOUT_ITEM_T> items;
+};
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+/* Width of the strip that makes the packed layout roughly square */
+static double _layout_strip_width(const LAYOUT_T *l)
+{
+    double area = 0;
+    double widest = 0;
+    for (size_t i = 0; i < l->items.size(); i++)
+    {
+        const LAYOUT_ITEM_T *item = &l->items[i];
+        area += (item->width + l->spacing_x) * (item->height + l->spacing_y);
+        widest = MAX(widest, item->width + l->spacing_x);
+    }
+    return MAX(widest, sqrt(area));
+}
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+LAYOUT_T *layout_create(double spacing_x, double spacing_y)
+{
+    LAYOUT_T *l = new LAYOUT_T;
+    l->spacing_x = spacing_x;
+    l->spacing_y = spacing_y;
+    l->width = 0;
+    l->height = 0;
+    return l;
+}
+
+void layout_destroy(LAYOUT_T *l)
+{
+    delete l;
+}
+
+size_t layout_add(LAYOUT_T *l, double width, double height)
+{
+    LAYOUT_ITEM_T item;
+    item.width = MAX(width, 0);
+    item.height = MAX(height, 0);
+    item.x = 0;
+    item.y = 0;
+    l->items.push_back(item);
+    return l->items.size() - 1;
+}
+
+void layout_pack(LAYOUT_T *l)
+{
+    size_t n = l->items.size();
+    l->width = 0;
+    l->height = 0;
+    if (n == 0)
+    {
+        return;
+    }
+
+    // Tallest first, so every shelf is as high as its first item
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [l](size_t a, size_t b) {
+        const LAYOUT_ITEM_T *ia = &l->items[a];
+        const LAYOUT_ITEM_T *ib = &l->items[b];
+        if (ia->height != ib->height)
+        {
+            return ia->height > ib->height;
+        }
+        return ia->width > ib->width;
+    });
+
+    double strip = _layout_strip_width(l);
+    double top = 0;
+
+    // Open shelves by room left: value is (x of next item, y of shelf)
+    std::multimap<double, std::pair<double, double>> shelves;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        LAYOUT_ITEM_T *item = &l->items[order[i]];
+        double w = item->width + l->spacing_x;
+
+        // Best fit: shelf with least room left that still takes the item
+        auto it = shelves.lower_bound(w);
+        if (it == shelves.end())
+        {
+            it = shelves.emplace(strip, std::make_pair(0.0, top));
+            top += item->height + l->spacing_y;
+        }
+
+        double room = it->first;
+        std::pair<double, double> shelf = it->second;
+        shelves.erase(it);
+
+        item->x = shelf.first;
+        item->y = shelf.second;
+        l->width = MAX(l->width, item->x + item->width);
+        l->height = MAX(l->height, item->y + item->height);
+
+        shelf.first += w;
+        shelves.emplace(room - w, shelf);
+    }
+}
+
+void layout_position(const LAYOUT_T *l, size_t item, double *x, double *y)
+{
+    *x = l->items[item].x;
+    *y = l->items[item].y;
+}
+
+void layout_extents(const LAYOUT_T *l, double *width, double *height)
+{
+    *width = l->width;
+    *height = l->height;
+}
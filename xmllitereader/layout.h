@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common.h"
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+/* Packs rectangular footprints (stacks of detail instances) in the XY plane */
+typedef struct LAYOUT LAYOUT_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+/* spacing_x/spacing_y is the gap kept between neighbouring items, in mm */
+LAYOUT_T *layout_create(double spacing_x, double spacing_y);
+void layout_destroy(LAYOUT_T *l);
+
+/* Returns item index, items are numbered in the order they are added */
+size_t layout_add(LAYOUT_T *l, double width, double height);
+
+/* Place all items added so far, previous placement is discarded.
+ * Items are sorted by height and filled into shelves of a strip about as wide
+ * as the layout is high, each into the shelf with least room left that fits it */
+void layout_pack(LAYOUT_T *l);
+
+/* Lower left corner of item after layout_pack(), layout starts at (0, 0) */
+void layout_position(const LAYOUT_T *l, size_t item, double *x /* out */, double *y /* out */);
+
+/* Size of the packed layout without trailing spacing */
+void layout_extents(const LAYOUT_T *l, double *width /* out */, double *height /* out */);
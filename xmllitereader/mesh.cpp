@@ -0,0 +1,230 @@
+#include "mesh.h"
+#include "tess.h"
+
+#include <string.h>
+
+#include <vector>
+#include <unordered_map>
+
+/***************************************************************/
+/*                       Local Types                           */
+/***************************************************************/
+
+/* Vertices are merged on exact coordinates, generation is deterministic
+ * so shared corners come out bit-identical */
+struct MESH_VERTEX_HASH {
+    size_t operator()(const GEOM_POINT_T &p) const
+    {
+        unsigned long long v[3];
+        memcpy(v, &p, sizeof(v));
+        unsigned long long h = v[0] * 0x9E3779B97F4A7C15ULL;
+        h ^= v[1] + 0x7F4A7C15ULL + (h << 6) + (h >> 2);
+        h ^= v[2] * 0xC2B2AE3D27D4EB4FULL;
+        return (size_t)(h ^ (h >> 29));
+    }
+};
+
+struct MESH_VERTEX_EQ {
+    bool operator()(const GEOM_POINT_T &a, const GEOM_POINT_T &b) const
+    {
+        return (a.x == b.x) && (a.y == b.y) && (a.z == b.z);
+    }
+};
+
+struct MESH {
+    std::vector<GEOM_POINT_T> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<MESH_FACE_T> faces;
+    std::vector<MESH_EDGE_T> edges;
+    std::vector<MESH_CURVE_T> curves;
+    std::vector<MESH_HOLE_T> holes;
+    std::unordered_map<GEOM_POINT_T, unsigned int, MESH_VERTEX_HASH, MESH_VERTEX_EQ> index;
+    std::vector<TESS_CIRCLE_T> circles; //scratch of circle batch
+    std::vector<GEOM_POINT_T> scratch; //circle tessellation
+};
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+static unsigned int _mesh_vertex(MESH_T *mesh, const GEOM_POINT_T *p)
+{
+    auto it = mesh->index.emplace(*p, (unsigned int)mesh->vertices.size());
+    if (it.second)
+    {
+        mesh->vertices.push_back(*p);
+    }
+    return it.first->second;
+}
+
+static int _mesh_face(void *data, const GEOM_POINT_T *points, size_t num_points, int material_id)
+{
+    MESH_T *mesh = (MESH_T *)data;
+    MESH_FACE_T face;
+    face.first = (unsigned int)mesh->indices.size();
+    face.count = (unsigned int)num_points;
+    face.material_id = material_id;
+
+    for (size_t i = 0; i < num_points; i++)
+    {
+        mesh->indices.push_back(_mesh_vertex(mesh, &points[i]));
+    }
+    mesh->faces.push_back(face);
+    return 0;
+}
+
+static int _mesh_edge(void *data, const GEOM_POINT_T *start, const GEOM_POINT_T *end)
+{
+    MESH_T *mesh = (MESH_T *)data;
+    MESH_EDGE_T edge;
+    edge.a = _mesh_vertex(mesh, start);
+    edge.b = _mesh_vertex(mesh, end);
+    mesh->edges.push_back(edge);
+    return 0;
+}
+
+static int _mesh_circles(void *data, const GEOM_POINT_T *centers, const double *r, size_t num_circles,
+                         const GEOM_POINT_T *normal, size_t num_segments)
+{
+    MESH_T *mesh = (MESH_T *)data;
+    const TESS_TABLE_T *t = tess_table(num_segments);
+    if (t == NULL)
+    {
+        return 0;
+    }
+
+    // All circles share the plane, tessellate the batch at once
+    mesh->circles.clear();
+    for (size_t i = 0; i < num_circles; i++)
+    {
+        if (r[i] > 0)
+        {
+            TESS_CIRCLE_T circle;
+            circle.center = centers[i];
+            circle.r = r[i];
+            mesh->circles.push_back(circle);
+        }
+    }
+    if (mesh->circles.empty())
+    {
+        return 0;
+    }
+
+    GEOM_POINT_T u, v;
+    tess_plane(normal, &u, &v);
+
+    mesh->scratch.resize(mesh->circles.size() * num_segments);
+    tess_circles(t, &u, &v, mesh->circles.data(), mesh->circles.size(), &mesh->scratch[0]);
+
+    for (size_t c = 0; c < mesh->circles.size(); c++)
+    {
+        const GEOM_POINT_T *points = &mesh->scratch[c * num_segments];
+
+        MESH_CURVE_T curve;
+        curve.first_edge = (unsigned int)mesh->edges.size();
+        curve.count = (unsigned int)num_segments;
+        curve.center = mesh->circles[c].center;
+        curve.normal = *normal;
+        mesh->curves.push_back(curve);
+
+        unsigned int first = _mesh_vertex(mesh, &points[0]);
+        unsigned int prev = first;
+        for (size_t i = 1; i < num_segments; i++)
+        {
+            MESH_EDGE_T edge;
+            edge.a = prev;
+            edge.b = _mesh_vertex(mesh, &points[i]);
+            mesh->edges.push_back(edge);
+            prev = edge.b;
+        }
+
+        MESH_EDGE_T edge;
+        edge.a = prev;
+        edge.b = first;
+        mesh->edges.push_back(edge);
+    }
+    return 0;
+}
+
+static int _mesh_hole(void *data, const GEOM_POINT_T *center, const GEOM_POINT_T *normal, const DRILL_T *dr)
+{
+    MESH_T *mesh = (MESH_T *)data;
+    MESH_HOLE_T hole;
+    hole.center = *center;
+    hole.normal = *normal;
+    hole.drill = *dr;
+    mesh->holes.push_back(hole);
+    return 0;
+}
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+MESH_T *mesh_create()
+{
+    return new MESH_T;
+}
+
+void mesh_destroy(MESH_T *mesh)
+{
+    delete mesh;
+}
+
+void mesh_reset(MESH_T *mesh)
+{
+    mesh->vertices.clear();
+    mesh->indices.clear();
+    mesh->faces.clear();
+    mesh->edges.clear();
+    mesh->curves.clear();
+    mesh->holes.clear();
+    mesh->index.clear();
+}
+
+GEOM_SINK_T mesh_sink(MESH_T *mesh, bool instance_holes)
+{
+    GEOM_SINK_T sink;
+    sink.face = _mesh_face;
+    sink.circles = _mesh_circles;
+    sink.edge = _mesh_edge;
+    sink.hole = instance_holes ? _mesh_hole : NULL;
+    sink.data = mesh;
+    return sink;
+}
+
+const GEOM_POINT_T *mesh_vertices(const MESH_T *mesh, size_t *count)
+{
+    *count = mesh->vertices.size();
+    return mesh->vertices.data();
+}
+
+const unsigned int *mesh_indices(const MESH_T *mesh, size_t *count)
+{
+    *count = mesh->indices.size();
+    return mesh->indices.data();
+}
+
+const MESH_FACE_T *mesh_faces(const MESH_T *mesh, size_t *count)
+{
+    *count = mesh->faces.size();
+    return mesh->faces.data();
+}
+
+const MESH_EDGE_T *mesh_edges(const MESH_T *mesh, size_t *count)
+{
+    *count = mesh->edges.size();
+    return mesh->edges.data();
+}
+
+const MESH_CURVE_T *mesh_curves(const MESH_T *mesh, size_t *count)
+{
+    *count = mesh->curves.size();
+    return mesh->curves.data();
+}
+
+const MESH_HOLE_T *mesh_holes(const MESH_T *mesh, size_t *count)
+{
+    *count = mesh->holes.size();
+    return mesh->holes.data();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "geometry.h"
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+/* Polygon over mesh_indices()[first .. first+count) */
+typedef struct {
+    unsigned int first;
+    unsigned int count;
+    int material_id;
+} MESH_FACE_T;
+
+typedef struct {
+    unsigned int a;
+    unsigned int b;
+} MESH_EDGE_T;
+
+/* Circle over mesh_edges()[first_edge .. first_edge+count) */
+typedef struct {
+    unsigned int first_edge;
+    unsigned int count;
+    GEOM_POINT_T center;
+    GEOM_POINT_T normal;
+} MESH_CURVE_T;
+
+/* Drill hole passed as a whole, see GEOM_SINK_T.hole */
+typedef struct {
+    GEOM_POINT_T center;
+    GEOM_POINT_T normal;
+    DRILL_T drill;
+} MESH_HOLE_T;
+
+/* In-memory indexed mesh backend, shared vertices are stored once.
+ * Circles are tessellated into edges and recorded as curves. Not thread-safe, use one per worker */
+typedef struct MESH MESH_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+MESH_T *mesh_create();
+void mesh_destroy(MESH_T *mesh);
+
+/* Drop content but keep allocated memory for the next detail */
+void mesh_reset(MESH_T *mesh);
+
+/* With instance_holes drill holes are recorded in mesh_holes() instead of
+ * being tessellated */
+GEOM_SINK_T mesh_sink(MESH_T *mesh, bool instance_holes);
+
+const GEOM_POINT_T *mesh_vertices(const MESH_T *mesh, size_t *count /* out */);
+const unsigned int *mesh_indices(const MESH_T *mesh, size_t *count /* out */);
+const MESH_FACE_T *mesh_faces(const MESH_T *mesh, size_t *count /* out */);
+const MESH_EDGE_T *mesh_edges(const MESH_T *mesh, size_t *count /* out */);
+const MESH_CURVE_T *mesh_curves(const MESH_T *mesh, size_t *count /* out */);
+const MESH_HOLE_T *mesh_holes(const MESH_T *mesh, size_t *count /* out */);
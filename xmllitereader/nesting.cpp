@@ -0,0 +1,551 @@
+#include "nesting.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+/***************************************************************/
+/*                     Local Definitions                       */
+/***************************************************************/
+
+#define NEST_OPEN_SHEETS    8   //sheets still searched for room, older ones are finished
+#define NEST_MAX_RESTARTS   256 //randomized orders per material after the fixed heuristics
+#define NEST_MAX_COPIES     100000 //of one detail, more is a broken amount
+
+/* Fixed heuristics are all combinations of these */
+#define NEST_ORDERS 5
+#define NEST_FITS   2
+#define NEST_SPLITS 2
+#define NEST_FIXED_HEURISTICS (NEST_ORDERS * NEST_FITS * NEST_SPLITS)
+
+/***************************************************************/
+/*                       Local Types                           */
+/***************************************************************/
+
+typedef struct {
+    int detail_id;
+    double width;
+    double height;
+    bool can_rotate;
+    size_t count; //copies of the part
+} NEST_PART_T;
+
+typedef struct {
+    size_t sheet;
+    double x;
+    double y;
+    double width;
+    double height;
+} NEST_FREE_T;
+
+typedef enum {
+    NEST_ORDER_AREA,
+    NEST_ORDER_HEIGHT,
+    NEST_ORDER_WIDTH,
+    NEST_ORDER_PERIMETER,
+    NEST_ORDER_LONG_SIDE,
+} NEST_ORDER_T;
+
+typedef enum {
+    NEST_FIT_AREA,          //free rectangle with least area left
+    NEST_FIT_SHORT_SIDE,    //free rectangle with shortest leftover side
+} NEST_FIT_T;
+
+typedef enum {
+    NEST_SPLIT_SHORTER,     //first cut along the shorter leftover, keeps the larger free piece whole
+    NEST_SPLIT_LONGER,
+} NEST_SPLIT_T;
+
+typedef struct {
+    NEST_ORDER_T order;
+    NEST_FIT_T fit;
+    NEST_SPLIT_T split;
+    unsigned seed; //0 for plain sort order
+} NEST_HEURISTIC_T;
+
+typedef struct {
+    size_t sheets;
+    size_t unplaced;
+    double last_used; //area used on last sheet, less leaves a better offcut
+    size_t rank; //heuristic number, breaks ties deterministically
+    std::vector<NEST_PLACEMENT_T> placements;
+    std::vector<NEST_CUT_T> cuts;
+} NEST_PLAN_T;
+
+typedef struct {
+    int material_id;
+    double thickness;
+    std::vector<NEST_PART_T> parts; //one per detail
+    size_t count; //all copies of parts
+
+    std::mutex lock;
+    bool has_best;
+    NEST_PLAN_T best;
+    size_t tried;
+    NEST_RESULT_T result;
+} NEST_GROUP_T;
+
+struct NEST {
+    NEST_PARAMS_T params;
+    std::vector<NEST_GROUP_T *> groups;
+    std::map<int, size_t> group_index; //by material id
+};
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+static double _nest_band_thickness(const VIYAR_PROJECT_T *project, int m_id)
+{
+    if ((m_id <= 0) || (m_id > project->materials_cnt))
+    {
+        return 0;
+    }
+    return project->materials[m_id-1].thickness;
+}
+
+static double _nest_order_key(NEST_ORDER_T order, const NEST_PART_T *p)
+{
+    switch (order)
+    {
+    case NEST_ORDER_AREA:       return p->width * p->height;
+    case NEST_ORDER_HEIGHT:     return p->height;
+    case NEST_ORDER_WIDTH:      return p->width;
+    case NEST_ORDER_PERIMETER:  return p->width + p->height;
+    case NEST_ORDER_LONG_SIDE:  return MAX(p->width, p->height);
+    }
+    return 0;
+}
+
+static NEST_HEURISTIC_T _nest_heuristic(size_t n)
+{
+    NEST_HEURISTIC_T h;
+    size_t fixed = n % NEST_FIXED_HEURISTICS;
+    h.order = (NEST_ORDER_T)(fixed % NEST_ORDERS);
+    h.fit = (NEST_FIT_T)((fixed / NEST_ORDERS) % NEST_FITS);
+    h.split = (NEST_SPLIT_T)(fixed / (NEST_ORDERS * NEST_FITS));
+    h.seed = (unsigned)(n / NEST_FIXED_HEURISTICS);
+    return h;
+}
+
+/* Piece (x, y, width, height) left after cutting part (pw x ph) from its lower left corner */
+static void _nest_split(const NEST_PARAMS_T *params, const NEST_FREE_T *fr, double pw, double ph,
+                        NEST_SPLIT_T split, std::vector<NEST_FREE_T> *free, NEST_PLAN_T *plan)
+{
+    double right = fr->width - pw - params->kerf;
+    double top = fr->height - ph - params->kerf;
+    bool horizontal_first = (split == NEST_SPLIT_SHORTER) ? (fr->width - pw < fr->height - ph)
+                                                          : (fr->width - pw >= fr->height - ph);
+
+    NEST_FREE_T r_right = {fr->sheet, fr->x + pw + params->kerf, fr->y, right, 0};
+    NEST_FREE_T r_top = {fr->sheet, fr->x, fr->y + ph + params->kerf, 0, top};
+    NEST_CUT_T cut_h = {fr->sheet, fr->x, fr->y + ph, 0, false};
+    NEST_CUT_T cut_v = {fr->sheet, fr->x + pw, fr->y, 0, true};
+
+    if (horizontal_first)
+    {
+        //Cut across the whole piece above the part, then beside the part
+        r_top.width = fr->width;
+        r_right.height = ph;
+        cut_h.length = fr->width;
+        cut_v.length = ph;
+        if (fr->height > ph)
+        {
+            plan->cuts.push_back(cut_h);
+        }
+        if (fr->width > pw)
+        {
+            plan->cuts.push_back(cut_v);
+        }
+    }
+    else
+    {
+        r_right.height = fr->height;
+        r_top.width = pw;
+        cut_v.length = fr->height;
+        cut_h.length = pw;
+        if (fr->width > pw)
+        {
+            plan->cuts.push_back(cut_v);
+        }
+        if (fr->height > ph)
+        {
+            plan->cuts.push_back(cut_h);
+        }
+    }
+
+    if ((r_right.width > 0) && (r_right.height > 0))
+    {
+        free->push_back(r_right);
+    }
+    if ((r_top.width > 0) && (r_top.height > 0))
+    {
+        free->push_back(r_top);
+    }
+}
+
+static void _nest_pack(const NEST_PARAMS_T *params, const NEST_GROUP_T *g, const NEST_HEURISTIC_T *h, NEST_PLAN_T *plan)
+{
+    const std::vector<NEST_PART_T> &parts = g->parts;
+    std::vector<size_t> sorted(parts.size());
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        sorted[i] = i;
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [&](size_t a, size_t b) {
+        return _nest_order_key(h->order, &parts[a]) > _nest_order_key(h->order, &parts[b]);
+    });
+
+    // Every copy is placed on its own, copies of a part start next to each other
+    std::vector<size_t> order;
+    order.reserve(g->count);
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        order.insert(order.end(), parts[sorted[i]].count, sorted[i]);
+    }
+
+    //Randomized restarts perturb the sorted order locally
+    if (h->seed > 0)
+    {
+        std::mt19937 rng(h->seed);
+        size_t swaps = order.size() / 4 + 1;
+        for (size_t i = 0; (i < swaps) && (order.size() > 1); i++)
+        {
+            size_t a = rng() % (order.size() - 1);
+            std::swap(order[a], order[a + 1]);
+        }
+    }
+
+    double usable_w = params->sheet_width - 2 * params->trim;
+    double usable_h = params->sheet_height - 2 * params->trim;
+
+    std::vector<NEST_FREE_T> free;
+    size_t first_open = 0; //free rectangles before it belong to finished sheets
+
+    plan->sheets = 0;
+    plan->unplaced = 0;
+    plan->placements.clear();
+    plan->cuts.clear();
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const NEST_PART_T *p = &parts[order[i]];
+        size_t best = SIZE_MAX;
+        bool best_rotated = false;
+        double best_score = 0;
+
+        for (int rotated = 0; rotated <= (p->can_rotate ? 1 : 0); rotated++)
+        {
+            double pw = rotated ? p->height : p->width;
+            double ph = rotated ? p->width : p->height;
+
+            for (size_t j = first_open; j < free.size(); j++)
+            {
+                const NEST_FREE_T *fr = &free[j];
+                if ((pw > fr->width) || (ph > fr->height))
+                {
+                    continue;
+                }
+
+                double score = (h->fit == NEST_FIT_AREA) ? (fr->width * fr->height - pw * ph)
+                                                         : MIN(fr->width - pw, fr->height - ph);
+                if ((best == SIZE_MAX) || (score < best_score))
+                {
+                    best = j;
+                    best_score = score;
+                    best_rotated = (rotated != 0);
+                }
+            }
+        }
+
+        if (best == SIZE_MAX)
+        {
+            bool fits = ((p->width <= usable_w) && (p->height <= usable_h))
+                || (p->can_rotate && (p->height <= usable_w) && (p->width <= usable_h));
+            if (!fits)
+            {
+                plan->unplaced++;
+                continue;
+            }
+
+            //New sheet, only the last NEST_OPEN_SHEETS sheets stay open
+            NEST_FREE_T sheet = {plan->sheets++, params->trim, params->trim, usable_w, usable_h};
+            free.push_back(sheet);
+            size_t j = free.size() - 1;
+            if (plan->sheets > NEST_OPEN_SHEETS)
+            {
+                size_t closed = plan->sheets - NEST_OPEN_SHEETS;
+                while ((first_open < j) && (free[first_open].sheet < closed))
+                {
+                    first_open++;
+                }
+            }
+
+            best = j;
+            best_rotated = !((p->width <= usable_w) && (p->height <= usable_h));
+        }
+
+        NEST_FREE_T fr = free[best];
+        double pw = best_rotated ? p->height : p->width;
+        double ph = best_rotated ? p->width : p->height;
+
+        // Keep free rectangles of a sheet together so closing sheets stays a prefix
+        free.erase(free.begin() + best);
+
+        NEST_PLACEMENT_T placement = {fr.sheet, p->detail_id, fr.x, fr.y, pw, ph, best_rotated};
+        plan->placements.push_back(placement);
+
+        std::vector<NEST_FREE_T> pieces;
+        _nest_split(params, &fr, pw, ph, h->split, &pieces, plan);
+
+        auto pos = std::upper_bound(free.begin() + first_open, free.end(), fr.sheet,
+                                    [](size_t sheet, const NEST_FREE_T &f) { return sheet < f.sheet; });
+        free.insert(pos, pieces.begin(), pieces.end());
+    }
+
+    plan->last_used = 0;
+    for (size_t i = 0; i < plan->placements.size(); i++)
+    {
+        const NEST_PLACEMENT_T *pl = &plan->placements[i];
+        if (pl->sheet + 1 == plan->sheets)
+        {
+            plan->last_used += pl->width * pl->height;
+        }
+    }
+
+    //Cuts were made part by part, cutting goes sheet by sheet
+    std::stable_sort(plan->cuts.begin(), plan->cuts.end(),
+                     [](const NEST_CUT_T &a, const NEST_CUT_T &b) { return a.sheet < b.sheet; });
+}
+
+static bool _nest_better(const NEST_PLAN_T *a, const NEST_PLAN_T *b)
+{
+    if (a->unplaced != b->unplaced)     return a->unplaced < b->unplaced;
+    if (a->sheets != b->sheets)         return a->sheets < b->sheets;
+    if (a->last_used != b->last_used)   return a->last_used < b->last_used;
+    if (a->cuts.size() != b->cuts.size()) return a->cuts.size() < b->cuts.size();
+    return a->rank < b->rank;
+}
+
+static void _nest_worker(NEST_T *nest, std::atomic<size_t> *next_task,
+                         std::chrono::steady_clock::time_point deadline)
+{
+    size_t num_groups = nest->groups.size();
+    size_t num_tasks = num_groups * (NEST_FIXED_HEURISTICS + NEST_MAX_RESTARTS);
+    NEST_PLAN_T plan;
+
+    for (;;)
+    {
+        size_t task = (*next_task)++;
+        if (task >= num_tasks)
+        {
+            break;
+        }
+
+        //First heuristic of every material always runs, the rest only within the budget
+        if ((task >= num_groups) && (std::chrono::steady_clock::now() > deadline))
+        {
+            break;
+        }
+
+        NEST_GROUP_T *g = nest->groups[task % num_groups];
+        size_t rank = task / num_groups;
+
+        // Randomized restarts only help when a heuristic choice was close
+        if ((rank >= NEST_FIXED_HEURISTICS) && (g->count < 3))
+        {
+            continue;
+        }
+
+        NEST_HEURISTIC_T h = _nest_heuristic(rank);
+        _nest_pack(&nest->params, g, &h, &plan);
+        plan.rank = rank;
+
+        std::lock_guard<std::mutex> guard(g->lock);
+        g->tried++;
+        if (!g->has_best || _nest_better(&plan, &g->best))
+        {
+            std::swap(g->best, plan);
+            g->has_best = true;
+        }
+    }
+}
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+NEST_PARAMS_T nest_default_params()
+{
+    NEST_PARAMS_T params;
+    params.sheet_width = NEST_DEFAULT_SHEET_WIDTH;
+    params.sheet_height = NEST_DEFAULT_SHEET_HEIGHT;
+    params.kerf = NEST_DEFAULT_KERF;
+    params.trim = NEST_DEFAULT_TRIM;
+    params.time_budget = NEST_DEFAULT_TIME_BUDGET;
+    params.num_workers = 0;
+    return params;
+}
+
+NEST_T *nest_create(const NEST_PARAMS_T *params)
+{
+    NEST_T *nest = new NEST_T;
+    nest->params = params ? *params : nest_default_params();
+    return nest;
+}
+
+void nest_destroy(NEST_T *nest)
+{
+    if (!nest)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < nest->groups.size(); i++)
+    {
+        delete nest->groups[i];
+    }
+    delete nest;
+}
+
+void nest_add(NEST_T *nest, const DETAIL_DEF_T *d, const VIYAR_PROJECT_T *project)
+{
+    if ((d->material_id <= 0) || (d->material_id > project->materials_cnt)
+            || (project->materials[d->material_id-1].type != TYPE_SHEET))
+    {
+        return;
+    }
+
+    auto it = nest->group_index.emplace(d->material_id, nest->groups.size());
+    if (it.second)
+    {
+        NEST_GROUP_T *g = new NEST_GROUP_T;
+        g->material_id = d->material_id;
+        g->thickness = project->materials[d->material_id-1].thickness;
+        g->count = 0;
+        g->has_best = false;
+        g->tried = 0;
+        memset(&g->result, 0, sizeof(g->result));
+        nest->groups.push_back(g);
+    }
+    NEST_GROUP_T *g = nest->groups[it.first->second];
+
+    // Bands are glued on the cut edges
+    NEST_PART_T part;
+    part.detail_id = d->id;
+    part.width = d->width - _nest_band_thickness(project, d->m_bands[SIDE_LEFT])
+                          - _nest_band_thickness(project, d->m_bands[SIDE_RIGHT]);
+    part.height = d->height - _nest_band_thickness(project, d->m_bands[SIDE_TOP])
+                            - _nest_band_thickness(project, d->m_bands[SIDE_BOTTOM]);
+    part.can_rotate = (d->grain == 0);
+
+    if ((part.width <= 0) || (part.height <= 0))
+    {
+        return;
+    }
+
+    // Amount comes from the project as is, a negative one has wrapped around
+    size_t multiplicity = MAX(d->multiplicity, 1);
+    if ((d->amount == 0) || (d->amount > NEST_MAX_COPIES / multiplicity))
+    {
+        if (d->amount > 0)
+        {
+            printf("Warning: detail %d amount %zd x %zd is out of range - not nested\n",
+                   d->id, d->amount, multiplicity);
+        }
+        return;
+    }
+
+    part.count = d->amount * multiplicity;
+    g->parts.push_back(part);
+    g->count += part.count;
+}
+
+int nest_run(NEST_T *nest)
+{
+    if (nest->groups.empty())
+    {
+        return 0;
+    }
+
+    size_t num_workers = nest->params.num_workers;
+    if (num_workers == 0)
+    {
+        num_workers = MAX(std::thread::hardware_concurrency(), 1);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(nest->params.time_budget);
+    std::atomic<size_t> next_task(0);
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < num_workers; i++)
+    {
+        workers.emplace_back(_nest_worker, nest, &next_task, deadline);
+    }
+    _nest_worker(nest, &next_task, deadline);
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+
+    double sheet_area = nest->params.sheet_width * nest->params.sheet_height;
+    for (size_t i = 0; i < nest->groups.size(); i++)
+    {
+        NEST_GROUP_T *g = nest->groups[i];
+        NEST_RESULT_T *r = &g->result;
+
+        // Unplaced parts take no sheet area
+        double parts_area = 0;
+        for (size_t j = 0; j < g->best.placements.size(); j++)
+        {
+            parts_area += g->best.placements[j].width * g->best.placements[j].height;
+        }
+
+        r->material_id = g->material_id;
+        r->thickness = g->thickness;
+        r->parts = g->count;
+        r->unplaced = g->best.unplaced;
+        r->sheets = g->best.sheets;
+        r->yield = (g->best.sheets > 0) ? parts_area / (g->best.sheets * sheet_area) : 0;
+        r->heuristics = g->tried;
+        r->placements = g->best.placements.empty() ? NULL : &g->best.placements[0];
+        r->placements_cnt = g->best.placements.size();
+        r->cuts = g->best.cuts.empty() ? NULL : &g->best.cuts[0];
+        r->cuts_cnt = g->best.cuts.size();
+    }
+    return 0;
+}
+
+size_t nest_result_count(const NEST_T *nest)
+{
+    return nest->groups.size();
+}
+
+const NEST_RESULT_T *nest_result(const NEST_T *nest, size_t i)
+{
+    return &nest->groups[i]->result;
+}
+
+void nest_print(const NEST_T *nest)
+{
+    printf("Nesting on %.0fx%.0f sheets, kerf %.1f, trim %.1f:\n",
+           nest->params.sheet_width, nest->params.sheet_height, nest->params.kerf, nest->params.trim);
+    for (size_t i = 0; i < nest->groups.size(); i++)
+    {
+        const NEST_RESULT_T *r = &nest->groups[i]->result;
+        printf("material %d (%.1f mm): %zd parts on %zd sheets, yield %.1f%%, %zd cuts, %zd plans tried\n",
+               r->material_id, r->thickness, r->parts, r->sheets, r->yield * 100, r->cuts_cnt, r->heuristics);
+        if (r->unplaced > 0)
+        {
+            printf("Warning: %zd parts of material %d do not fit on a sheet\n", r->unplaced, r->material_id);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "viyar.h"
+
+/***************************************************************/
+/*                     Global Definitions                      */
+/***************************************************************/
+
+#define NEST_DEFAULT_SHEET_WIDTH    2800 //mm, along sheet grain
+#define NEST_DEFAULT_SHEET_HEIGHT   2070 //mm
+#define NEST_DEFAULT_KERF           4    //mm, saw blade
+#define NEST_DEFAULT_TRIM           10   //mm, trimmed from every sheet edge
+#define NEST_DEFAULT_TIME_BUDGET    200  //ms for all heuristics
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+typedef struct {
+    double sheet_width;
+    double sheet_height;
+    double kerf;
+    double trim;
+    unsigned time_budget; //ms
+    size_t num_workers; //0 selects number of cores
+} NEST_PARAMS_T;
+
+/* Guillotine cut through a whole piece: vertical cuts run along y from (x, y) */
+typedef struct {
+    size_t sheet;
+    double x;
+    double y;
+    double length;
+    bool vertical;
+} NEST_CUT_T;
+
+typedef struct {
+    size_t sheet;
+    int detail_id;
+    double x; //lower left corner on sheet
+    double y;
+    double width; //cut size as placed
+    double height;
+    bool rotated;
+} NEST_PLACEMENT_T;
+
+/* Best plan found for one sheet material */
+typedef struct {
+    int material_id;
+    double thickness;
+    size_t parts;
+    size_t unplaced; //parts larger than the sheet
+    size_t sheets;
+    double yield; //area of placed parts / area of sheets used
+    size_t heuristics; //plans tried
+    const NEST_PLACEMENT_T *placements;
+    size_t placements_cnt;
+    const NEST_CUT_T *cuts; //in cutting order, sheet by sheet
+    size_t cuts_cnt;
+} NEST_RESULT_T;
+
+/* Cutting plan of all sheet details of a project, collected as details stream in */
+typedef struct NEST NEST_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+NEST_PARAMS_T nest_default_params();
+
+NEST_T *nest_create(const NEST_PARAMS_T *params /* NULL for defaults */);
+void nest_destroy(NEST_T *nest);
+
+/* Add amount * multiplicity parts of detail, cut size is detail size without
+ * band thickness. Details with grain keep their orientation on the sheet.
+ * Details with zero or implausible amount are skipped */
+void nest_add(NEST_T *nest, const DETAIL_DEF_T *d, const VIYAR_PROJECT_T *project);
+
+/* Try packing heuristics for all materials on worker threads within the time budget */
+int nest_run(NEST_T *nest);
+
+size_t nest_result_count(const NEST_T *nest);
+const NEST_RESULT_T *nest_result(const NEST_T *nest, size_t i);
+
+void nest_print(const NEST_T *nest);
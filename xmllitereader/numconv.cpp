@@ -0,0 +1,319 @@
+#include "numconv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <locale.h>
+#endif
+
+extern "C"
+{
+
+/***************************************************************/
+/*                     Local Definitions                       */
+/***************************************************************/
+
+#define NUM_MAX_DIGITS      19  //significant digits that always fit into unsigned long long
+#define NUM_EXACT_MANTISSA  (1ULL << 53)
+#define NUM_EXACT_POW10     22  //largest power of 10 exact in double
+#define NUM_SLOW_MAX_LEN    128
+
+/***************************************************************/
+/*                     Local Variables                         */
+/***************************************************************/
+
+static const double _pow10[NUM_EXACT_POW10 + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+static inline bool _is_digit(char c)
+{
+    return (unsigned)(c - '0') < 10;
+}
+
+/* Correctly rounded conversion of a validated number in the "C" locale,
+ * for the rare values the exact fast path cannot take */
+static int _strtod_c(const char *first, size_t len, double *value)
+{
+    char small[NUM_SLOW_MAX_LEN + 1];
+    char *buf = (len <= NUM_SLOW_MAX_LEN) ? small : (char *)malloc(len + 1);
+    if (buf == NULL)
+    {
+        return NUM_RANGE;
+    }
+    memcpy(buf, first, len);
+    buf[len] = '\0';
+
+    errno = 0;
+#ifdef _WIN32
+    static _locale_t c_locale = _create_locale(LC_NUMERIC, "C");
+    double d = _strtod_l(buf, NULL, c_locale);
+#else
+    static locale_t c_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+    double d = strtod_l(buf, NULL, c_locale);
+#endif
+    bool overflow = (errno == ERANGE) && isinf(d);
+
+    if (buf != small)
+    {
+        free(buf);
+    }
+    if (overflow)
+    {
+        return NUM_RANGE;
+    }
+    *value = d;
+    return NUM_OK;
+}
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+NUM_RESULT_T num_from_chars_long(const char *first, const char *last, long *value)
+{
+    NUM_RESULT_T res = {first, NUM_INVALID};
+    const char *p = first;
+    bool negative = false;
+
+    if ((p < last) && ((*p == '-') || (*p == '+')))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+    if ((p == last) || !_is_digit(*p))
+    {
+        return res;
+    }
+
+    unsigned long long limit = negative ? (unsigned long long)LONG_MAX + 1 : (unsigned long long)LONG_MAX;
+    unsigned long long n = 0;
+    bool overflow = false;
+    for (; (p < last) && _is_digit(*p); p++)
+    {
+        // Checked before multiplying, n stays within limit and cannot wrap
+        unsigned digit = (unsigned)(*p - '0');
+        if (overflow || (n > (limit - digit) / 10))
+        {
+            overflow = true;
+        }
+        else
+        {
+            n = n * 10 + digit;
+        }
+    }
+
+    res.ptr = p;
+    if (overflow)
+    {
+        res.ec = NUM_RANGE;
+        return res;
+    }
+
+    *value = negative ? (long)(0 - n) : (long)n;
+    res.ec = NUM_OK;
+    return res;
+}
+
+NUM_RESULT_T num_from_chars_double(const char *first, const char *last, double *value)
+{
+    NUM_RESULT_T res = {first, NUM_INVALID};
+    const char *p = first;
+    bool negative = false;
+
+    if ((p < last) && ((*p == '-') || (*p == '+')))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+
+    unsigned long long mantissa = 0;
+    int digits = 0;         //significant digits in mantissa
+    int exponent = 0;       //decimal exponent of mantissa
+    bool truncated = false; //nonzero digits beyond NUM_MAX_DIGITS
+    bool any = false;
+
+    for (; (p < last) && _is_digit(*p); p++)
+    {
+        any = true;
+        if (digits < NUM_MAX_DIGITS)
+        {
+            mantissa = mantissa * 10 + (unsigned)(*p - '0');
+            digits += (mantissa != 0);
+        }
+        else
+        {
+            exponent++;
+            truncated = truncated || (*p != '0');
+        }
+    }
+
+    if ((p < last) && (*p == '.'))
+    {
+        p++;
+        for (; (p < last) && _is_digit(*p); p++)
+        {
+            any = true;
+            if (digits < NUM_MAX_DIGITS)
+            {
+                mantissa = mantissa * 10 + (unsigned)(*p - '0');
+                digits += (mantissa != 0);
+                exponent--;
+            }
+            else
+            {
+                truncated = truncated || (*p != '0');
+            }
+        }
+    }
+
+    if (!any)
+    {
+        return res;
+    }
+
+    // Exponent is only taken when digits follow, like strtod
+    if ((p < last) && ((*p == 'e') || (*p == 'E')))
+    {
+        const char *e = p + 1;
+        bool e_negative = false;
+        if ((e < last) && ((*e == '-') || (*e == '+')))
+        {
+            e_negative = (*e == '-');
+            e++;
+        }
+        if ((e < last) && _is_digit(*e))
+        {
+            int n = 0;
+            for (; (e < last) && _is_digit(*e); e++)
+            {
+                n = MIN(n * 10 + (*e - '0'), 100000);
+            }
+            exponent += e_negative ? -n : n;
+            p = e;
+        }
+    }
+
+    res.ptr = p;
+    double d;
+
+    if (mantissa == 0)
+    {
+        d = 0.0;
+    }
+    else if (!truncated && (mantissa <= NUM_EXACT_MANTISSA)
+             && (exponent >= -NUM_EXACT_POW10) && (exponent <= NUM_EXACT_POW10))
+    {
+        // Both operands are exact, so the single rounding gives the correct result
+        d = (double)mantissa;
+        d = (exponent < 0) ? d / _pow10[-exponent] : d * _pow10[exponent];
+    }
+    else
+    {
+        res.ec = _strtod_c(first, p - first, &d);
+        if (res.ec != NUM_OK)
+        {
+            return res;
+        }
+        *value = d;
+        return res;
+    }
+
+    *value = negative ? -d : d;
+    res.ec = NUM_OK;
+    return res;
+}
+
+} //extern "C"
+
+#ifdef NUMCONV_BENCH
+/* Standalone benchmark against the C library:
+ * g++ -O2 -DNUMCONV_BENCH numconv.cpp common.cpp */
+#include <chrono>
+#include <string>
+#include <vector>
+
+int main(int argc, char **argv)
+{
+    size_t count = (argc > 1) ? (size_t)atol(argv[1]) : 1000000;
+
+    // Attribute values as they appear in projects: sizes, coordinates, diameters
+    std::vector<std::string> values;
+    srand(1);
+    for (size_t i = 0; i < count; i++)
+    {
+        char buf[32];
+        switch (i % 4)
+        {
+        case 0: snprintf(buf, sizeof(buf), "%d", rand() % 3000); break;
+        case 1: snprintf(buf, sizeof(buf), "%d.%d", rand() % 3000, rand() % 10); break;
+        case 2: snprintf(buf, sizeof(buf), "%.4f", (rand() % 100000) / 1000.0); break;
+        default: snprintf(buf, sizeof(buf), "%.17g", rand() / 7.0); break;
+        }
+        values.push_back(buf);
+    }
+
+    double sum_lib = 0, sum_num = 0;
+    size_t mismatches = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        sum_lib += strtod(values[i].c_str(), NULL);
+    }
+    double t_lib = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        double d = 0;
+        num_from_chars_double(values[i].data(), values[i].data() + values[i].size(), &d);
+        sum_num += d;
+    }
+    double t_num = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        double d = 0;
+        num_from_chars_double(values[i].data(), values[i].data() + values[i].size(), &d);
+        if (d != strtod(values[i].c_str(), NULL))
+        {
+            mismatches++;
+        }
+    }
+
+    printf("strtod:                %6.1f ns/value\n", t_lib * 1e9 / count);
+    printf("num_from_chars_double: %6.1f ns/value, %zd mismatches\n", t_num * 1e9 / count, mismatches);
+
+    start = std::chrono::steady_clock::now();
+    long lsum_lib = 0, lsum_num = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        lsum_lib += strtol(values[i].c_str(), NULL, 10);
+    }
+    t_lib = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        long l = 0;
+        num_from_chars_long(values[i].data(), values[i].data() + values[i].size(), &l);
+        lsum_num += l;
+    }
+    t_num = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("strtol:                %6.1f ns/value\n", t_lib * 1e9 / count);
+    printf("num_from_chars_long:   %6.1f ns/value (%s)\n", t_num * 1e9 / count,
+           (lsum_lib == lsum_num) ? "same results" : "DIFFERENT RESULTS");
+    return (sum_lib == sum_num) ? 0 : 1;
+}
+#endif
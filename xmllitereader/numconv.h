@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+
+/***************************************************************/
+/*                     Global Definitions                      */
+/***************************************************************/
+
+#define NUM_OK          0
+#define NUM_INVALID     (-1)    //no number at the start of the input
+#define NUM_RANGE       (-2)    //number does not fit into the result type
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+extern "C"
+{
+
+/* Same contract as std::from_chars: ptr is past the last character of the
+ * number (first on NUM_INVALID), value is only written on NUM_OK */
+typedef struct {
+    const char *ptr;
+    int ec;
+} NUM_RESULT_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+/* Decimal integer with optional sign */
+NUM_RESULT_T num_from_chars_long(const char *first, const char *last, long *value /* out */);
+
+/* Decimal floating point "[+-]digits[.digits][e[+-]digits]", always with '.'
+ * as decimal separator whatever the current locale; no inf/nan/hex */
+NUM_RESULT_T num_from_chars_double(const char *first, const char *last, double *value /* out */);
+
+} //extern "C"
@@ -0,0 +1,374 @@
+#include "outline.h"
+#include "tess.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/***************************************************************/
+/*                     Local Definitions                       */
+/***************************************************************/
+
+#define OUTLINE_PI 3.14159265358979323846
+
+/***************************************************************/
+/*                       Local Types                           */
+/***************************************************************/
+
+/* Corner in its own frame: dx/dy point from the corner into the sheet along
+ * the edges. The outline arrives along x_first ? x edge : y edge */
+typedef struct {
+    double x;
+    double y;
+    double dx;
+    double dy;
+    bool x_first;
+} CORNER_FRAME_T;
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+static bool _outline_reserve(OUTLINE_T *o, size_t count)
+{
+    if (count <= o->size)
+    {
+        return true;
+    }
+
+    size_t size = MAX(o->size * 2, count);
+    GEOM_POINT_T *points = (GEOM_POINT_T *)malloc(size * sizeof(GEOM_POINT_T));
+    int *materials = (int *)malloc(size * sizeof(int));
+    if ((points == NULL) || (materials == NULL))
+    {
+        free(points);
+        free(materials);
+        return false;
+    }
+
+    memcpy(points, o->points, o->count * sizeof(GEOM_POINT_T));
+    memcpy(materials, o->materials, o->count * sizeof(int));
+    if (o->points != o->inline_points)
+    {
+        free(o->points);
+        free(o->materials);
+    }
+    o->points = points;
+    o->materials = materials;
+    o->size = size;
+    return true;
+}
+
+static void _outline_add(OUTLINE_T *o, double x, double y, int material)
+{
+    GEOM_POINT_T *p = &o->points[o->count];
+    p->x = x;
+    p->y = y;
+    p->z = 0;
+    o->materials[o->count] = material;
+    o->count++;
+}
+
+static double _band_thickness(const VIYAR_PROJECT_T *project, int m_id)
+{
+    if ((m_id <= 0) || (m_id > project->materials_cnt))
+    {
+        return 0;
+    }
+    return project->materials[m_id-1].thickness;
+}
+
+/* Quarter arc segments keeping the chord sagitta r*(1 - cos(a/2)) within tolerance */
+static size_t _arc_segments(double r, double tolerance)
+{
+    if (tolerance >= r)
+    {
+        return 1;
+    }
+    double a = 2 * acos(1 - tolerance / r);
+    size_t n = (size_t)ceil((OUTLINE_PI / 2) / a);
+    return MIN(MAX(n, 1), TESS_MAX_SEGMENTS / 4);
+}
+
+/* Unit-circle index of axis direction (ux, uy) with num_segments = 4*quarter */
+static size_t _axis_index(double ux, double uy, size_t quarter)
+{
+    if (ux > 0.5)   return 0;
+    if (uy > 0.5)   return quarter;
+    if (ux < -0.5)  return 2 * quarter;
+    return 3 * quarter;
+}
+
+/* Quarter arc around (cx, cy) from first to last point, both on the circle
+ * and on the axes of the center. Endpoints are added exactly */
+static bool _outline_arc(OUTLINE_T *o, double cx, double cy, double r,
+                         double x0, double y0, double x1, double y1,
+                         int material, double tolerance)
+{
+    size_t quarter = _arc_segments(r, tolerance);
+    //first point, tessellation scratch of quarter + 1 points and the closing point
+    if (!_outline_reserve(o, o->count + quarter + 3))
+    {
+        return false;
+    }
+
+    _outline_add(o, x0, y0, material);
+    if (quarter > 1)
+    {
+        const TESS_TABLE_T *t = tess_table(4 * quarter);
+        GEOM_POINT_T u = {1, 0, 0};
+        GEOM_POINT_T v = {0, 1, 0};
+        TESS_CIRCLE_T circle = {{cx, cy, 0}, r};
+
+        size_t i0 = _axis_index(x0 - cx, y0 - cy, quarter);
+        size_t i1 = _axis_index(x1 - cx, y1 - cy, quarter);
+        bool ccw = ((i0 + quarter) % (4 * quarter)) == i1;
+
+        // Tessellate counterclockwise, inner points only
+        GEOM_POINT_T *arc = &o->points[o->count];
+        tess_arc(t, &u, &v, &circle, ccw ? i0 : i1, quarter, arc);
+        if (!ccw)
+        {
+            for (size_t i = 0, j = quarter; i < j; i++, j--)
+            {
+                GEOM_POINT_T tmp = arc[i];
+                arc[i] = arc[j];
+                arc[j] = tmp;
+            }
+        }
+        memmove(arc, arc + 1, (quarter - 1) * sizeof(GEOM_POINT_T));
+        for (size_t i = 0; i < quarter - 1; i++)
+        {
+            o->materials[o->count + i] = material;
+        }
+        o->count += quarter - 1;
+    }
+    return true;
+}
+
+static bool _corner_operation(OUTLINE_T *o, const CORNER_FRAME_T *f, int side_material,
+                              const OPERATION_T *cop, const VIYAR_PROJECT_T *project, double tolerance)
+{
+    double X = cop->x;
+    double Y = cop->y;
+    double R = (cop->r > 0) ? cop->r : cop->x;
+    int material_H = 1; //same as for sheet
+    int material_V = 1;
+
+    if (cop->edgeMaterial > 0)
+    {
+        double thickness = _band_thickness(project, cop->edgeMaterial);
+
+        if (cop->edgeCovering == EDGE_COVER_BOTH)
+        {
+            X -= thickness;
+            Y -= thickness;
+            R -= thickness;
+            material_H = cop->edgeMaterial;
+            material_V = cop->edgeMaterial;
+        }
+        else if (cop->edgeCovering == EDGE_COVER_H)
+        {
+            material_H = cop->edgeMaterial;
+            Y -= thickness;
+        }
+        else if (cop->edgeCovering == EDGE_COVER_V)
+        {
+            material_V = cop->edgeMaterial;
+            X -= thickness;
+        }
+    }
+
+    if (cop->subtype == CORNER_SUBTYPE_RADIUS)
+    {
+        X = Y = R;
+    }
+
+    // Points where the cut leaves the incoming edge and joins the outgoing one
+    double xa = f->x + X * f->dx, ya = f->y;
+    double xb = f->x, yb = f->y + Y * f->dy;
+    if (!f->x_first)
+    {
+        double tx = xa, ty = ya;
+        xa = xb; ya = yb;
+        xb = tx; yb = ty;
+    }
+
+    // Segment with constant x gets material_H, constant y gets material_V
+    int first_material = f->x_first ? material_H : material_V;
+    int second_material = f->x_first ? material_V : material_H;
+
+    if (!_outline_reserve(o, o->count + 3))
+    {
+        return false;
+    }
+
+    // Only radius has a known ext=0 shape
+    if ((cop->ext != 1) && ((cop->subtype == CORNER_SUBTYPE_CHAMFER) || (cop->subtype == CORNER_SUBTYPE_NOTCH)))
+    {
+        printf("Corner operation subtype=%d ext=%d not supported - corner left square.\n", cop->subtype, cop->ext);
+        _outline_add(o, f->x, f->y, side_material);
+        return true;
+    }
+
+    switch (cop->subtype)
+    {
+    case CORNER_SUBTYPE_CHAMFER:
+        _outline_add(o, xa, ya, first_material);
+        _outline_add(o, xb, yb, side_material);
+        break;
+
+    case CORNER_SUBTYPE_RADIUS:
+        if (cop->ext == 1)
+        {
+            double cx = f->x + R * f->dx;
+            double cy = f->y + R * f->dy;
+            if (!_outline_arc(o, cx, cy, R, xa, ya, xb, yb, first_material, tolerance))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            if (!_outline_arc(o, f->x, f->y, R, xa, ya, xb, yb, first_material, tolerance))
+            {
+                return false;
+            }
+        }
+        _outline_add(o, xb, yb, side_material);
+        break;
+
+    case CORNER_SUBTYPE_NOTCH:
+        _outline_add(o, xa, ya, first_material);
+        _outline_add(o, f->x + X * f->dx, f->y + Y * f->dy, second_material);
+        _outline_add(o, xb, yb, side_material);
+        break;
+
+    default:
+        printf("Corner operation subtype=%d not supported - corner left square.\n", cop->subtype);
+        _outline_add(o, f->x, f->y, side_material);
+        break;
+    }
+    return true;
+}
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+void outline_init(OUTLINE_T *o)
+{
+    o->points = o->inline_points;
+    o->materials = o->inline_materials;
+    o->count = 0;
+    o->size = OUTLINE_INLINE_POINTS;
+}
+
+void outline_free(OUTLINE_T *o)
+{
+    if (o->points != o->inline_points)
+    {
+        free(o->points);
+        free(o->materials);
+    }
+    outline_init(o);
+}
+
+int outline_build(OUTLINE_T *o, const DETAIL_DEF_T *d, const VIYAR_PROJECT_T *project, double chord_tolerance)
+{
+    double W = d->width;
+    double H = d->height;
+
+    // Clockwise from lower left, the outline arrives at lower left along the bottom edge
+    const CORNER_FRAME_T frames[CORNER_MAX] = {
+        {0, 0,  1,  1, true},   //CORNER_LOWER_LEFT
+        {0, H,  1, -1, false},  //CORNER_UPPER_LEFT
+        {W, H, -1, -1, true},   //CORNER_UPPER_RIGHT
+        {W, 0, -1,  1, false},  //CORNER_LOWER_RIGHT
+    };
+
+    // One operation per corner, the last one wins
+    const OPERATION_T *corner[CORNER_MAX];
+    memset(corner, 0, sizeof(corner));
+    for (size_t j = 0; j < d->operations_cnt; j++)
+    {
+        const OPERATION_T *op = &d->operations[j];
+        if (op->type == TYPE_CORNEROPERATION)
+        {
+            if ((op->corner <= 0) || (op->corner > CORNER_MAX))
+            {
+                PARSE_FAIL(-1);
+            }
+            corner[op->corner-1] = op;
+        }
+    }
+
+    o->count = 0;
+    for (size_t cn = 0; cn < CORNER_MAX; cn++)
+    {
+        // Outgoing edge of corner cn carries band m_bands[cn+1] (left, top, right, bottom)
+        int side_material = d->m_bands[cn+1];
+
+        if (corner[cn] == NULL)
+        {
+            if (!_outline_reserve(o, o->count + 1))
+            {
+                return -1;
+            }
+            _outline_add(o, frames[cn].x, frames[cn].y, side_material);
+        }
+        else if (!_corner_operation(o, &frames[cn], side_material, corner[cn], project, chord_tolerance))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#ifdef OUTLINE_BENCH
+/* Standalone benchmark: g++ -O2 -DOUTLINE_BENCH outline.cpp tess.cpp geometry.cpp viyar.cpp xmlsax.cpp numconv.cpp common.cpp */
+#include <chrono>
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: outline_bench <viyar_project_file> [iterations]\n");
+        return 0;
+    }
+
+    wchar_t path[1024];
+    mbstowcs(path, argv[1], 1024);
+    int iterations = (argc > 2) ? atoi(argv[2]) : 100;
+
+    VIYAR_PROJECT_T project = project_init();
+    if (parse_xml(path, &project) != 0)
+    {
+        return 1;
+    }
+
+    OUTLINE_T o;
+    outline_init(&o);
+    size_t points = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++)
+    {
+        for (int i = 0; i < project.details_cnt; i++)
+        {
+            outline_build(&o, &project.details[i], &project, OUTLINE_DEFAULT_CHORD_TOLERANCE);
+            points += o.count;
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t panels = (size_t)iterations * project.details_cnt;
+    printf("%zd panels, %.1f points/panel, %.1f ns/panel\n",
+           panels, (double)points / MAX(panels, 1), elapsed * 1e9 / MAX(panels, 1));
+
+    outline_free(&o);
+    project_destroy(&project);
+    return 0;
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "geometry.h"
+
+/***************************************************************/
+/*                     Global Definitions                      */
+/***************************************************************/
+
+#define OUTLINE_DEFAULT_CHORD_TOLERANCE 0.05 //mm, max distance of radius chords from the arc
+#define OUTLINE_INLINE_POINTS 32 //typical panels never allocate
+
+/* Corner operation subtypes */
+#define CORNER_SUBTYPE_CHAMFER  1   //ext=1 straight cut from x to y
+#define CORNER_SUBTYPE_RADIUS   2   //ext=1 rounded corner, ext=0 concave arc around the corner
+#define CORNER_SUBTYPE_NOTCH    3   //ext=1 rectangular cut-out x by y
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+/* Closed polygon of the sheet in the detail XY plane (z = 0), clockwise
+ * starting at the lower left corner. materials[i] is the band material id of
+ * the segment from points[i] to points[i+1] (0 = none) */
+typedef struct {
+    GEOM_POINT_T *points;
+    int *materials;
+    size_t count;
+    size_t size;
+    GEOM_POINT_T inline_points[OUTLINE_INLINE_POINTS];
+    int inline_materials[OUTLINE_INLINE_POINTS];
+} OUTLINE_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+void outline_init(OUTLINE_T *o);
+void outline_free(OUTLINE_T *o);
+
+/* Build sheet outline of detail with all corner operations applied,
+ * radius corners are tessellated within chord_tolerance (mm) */
+int outline_build(OUTLINE_T *o, const DETAIL_DEF_T *d, const VIYAR_PROJECT_T *project, double chord_tolerance);
@@ -0,0 +1,500 @@
+#include "project_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <vector>
+
+/***************************************************************/
+/*                     Local Definitions                       */
+/***************************************************************/
+
+#define CACHE_MAGIC "VPC\x1A"
+
+#define CACHE_HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define CACHE_HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define CACHE_HASH_LANES  4
+
+/***************************************************************/
+/*                       Local Types                           */
+/***************************************************************/
+
+/* File layout: header, then materials, details, operations and strings
+ * arrays back to back. Records have fixed size and 8 byte alignment so
+ * they are used in place from the mapping; references are array indexes */
+typedef struct {
+    char magic[4];
+    unsigned int version;
+    unsigned int wchar_size;        //strings are stored as wchar_t of the writing build
+    unsigned int materials_cnt;
+    unsigned long long key;
+    unsigned int details_cnt;
+    unsigned int operations_cnt;
+    unsigned int strings_cnt;       //wchar_t units, index 0 is the empty string = none
+    unsigned int reserved;
+} CACHE_HEADER_T;
+
+typedef struct {
+    int type;
+    int reserved;
+    double thickness;
+} CACHE_MATERIAL_T;
+
+typedef struct {
+    int id;
+    int material_id;
+    double width;
+    double height;
+    double thickness;
+    int multiplicity;
+    int grain;
+    unsigned long long amount;
+    int m_bands[6];
+    unsigned int name;              //string index, 0 = none
+    unsigned int operations;        //index of first operation
+    unsigned int operations_cnt;
+    unsigned int reserved;
+} CACHE_DETAIL_T;
+
+typedef struct {
+    int type;
+    int side;
+    int corner;
+    int mill;
+    int ext;
+    int edgeMaterial;
+    int edgeCovering;
+    int subtype;
+    double x;
+    double y;
+    double xo;
+    double yo;
+    double d;
+    double depth;
+    double millD;
+    double r;
+    unsigned int xl;                //string index, 0 = none
+    unsigned int yl;
+} CACHE_OPERATION_T;
+
+static_assert(sizeof(CACHE_HEADER_T) == 40, "cache header layout");
+static_assert(sizeof(CACHE_MATERIAL_T) == 16, "cache material layout");
+static_assert(sizeof(CACHE_DETAIL_T) == 88, "cache detail layout");
+static_assert(sizeof(CACHE_OPERATION_T) == 104, "cache operation layout");
+
+struct PROJECT_CACHE {
+    MAPPED_FILE_T mf;
+    const CACHE_HEADER_T *header;
+    const CACHE_MATERIAL_T *materials;
+    const CACHE_DETAIL_T *details;
+    const CACHE_OPERATION_T *operations;
+    const wchar_t *strings;
+};
+
+struct PROJECT_CACHE_WRITER {
+    std::vector<CACHE_DETAIL_T> details;
+    std::vector<CACHE_OPERATION_T> operations;
+    std::vector<wchar_t> strings;
+};
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+static unsigned long long _rotl(unsigned long long v, int n)
+{
+    return (v << n) | (v >> (64 - n));
+}
+
+static unsigned long long _hash_round(unsigned long long acc, unsigned long long v)
+{
+    return _rotl(acc + v * CACHE_HASH_PRIME2, 31) * CACHE_HASH_PRIME1;
+}
+
+/* Word-wise multiply-rotate hash with independent lanes, several times
+ * faster than bytewise FNV on large project files */
+static unsigned long long _hash(const char *data, size_t size)
+{
+    unsigned long long lanes[CACHE_HASH_LANES] = {
+        CACHE_HASH_PRIME1, CACHE_HASH_PRIME2, 0, (unsigned long long)0 - CACHE_HASH_PRIME1,
+    };
+
+    size_t pos = 0;
+    for (; pos + CACHE_HASH_LANES * 8 <= size; pos += CACHE_HASH_LANES * 8)
+    {
+        for (int i = 0; i < CACHE_HASH_LANES; i++)
+        {
+            unsigned long long v;
+            memcpy(&v, data + pos + i * 8, 8);
+            lanes[i] = _hash_round(lanes[i], v);
+        }
+    }
+
+    unsigned long long h = size;
+    for (int i = 0; i < CACHE_HASH_LANES; i++)
+    {
+        h = _hash_round(h, lanes[i]);
+    }
+    for (; pos < size; pos++)
+    {
+        h = _hash_round(h, (unsigned char)data[pos]);
+    }
+
+    h ^= h >> 33;
+    h *= CACHE_HASH_PRIME2;
+    h ^= h >> 29;
+    return h;
+}
+
+static size_t _cache_size(const CACHE_HEADER_T *h)
+{
+    return sizeof(CACHE_HEADER_T)
+         + (size_t)h->materials_cnt * sizeof(CACHE_MATERIAL_T)
+         + (size_t)h->details_cnt * sizeof(CACHE_DETAIL_T)
+         + (size_t)h->operations_cnt * sizeof(CACHE_OPERATION_T)
+         + (size_t)h->strings_cnt * sizeof(wchar_t);
+}
+
+/* Indexes are checked once on open, streaming trusts them */
+static bool _cache_valid(const PROJECT_CACHE_T *cache)
+{
+    const CACHE_HEADER_T *h = cache->header;
+
+    if ((h->strings_cnt == 0) || (cache->strings[0] != 0) || (cache->strings[h->strings_cnt - 1] != 0))
+    {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < h->details_cnt; i++)
+    {
+        const CACHE_DETAIL_T *cd = &cache->details[i];
+        if ((cd->name >= h->strings_cnt) || (cd->operations > h->operations_cnt)
+                || (cd->operations_cnt > h->operations_cnt - cd->operations))
+        {
+            return false;
+        }
+    }
+
+    for (unsigned int i = 0; i < h->operations_cnt; i++)
+    {
+        const CACHE_OPERATION_T *co = &cache->operations[i];
+        if ((co->xl >= h->strings_cnt) || (co->yl >= h->strings_cnt))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static wchar_t *_cache_string(const PROJECT_CACHE_T *cache, unsigned int index)
+{
+    // Strings are read only in the mapping, wchar_t * only to fit DETAIL_DEF_T
+    return index ? (wchar_t *)(cache->strings + index) : NULL;
+}
+
+static unsigned int _writer_string(PROJECT_CACHE_WRITER_T *w, const wchar_t *s)
+{
+    if (s == NULL)
+    {
+        return 0;
+    }
+
+    unsigned int index = (unsigned int)w->strings.size();
+    w->strings.insert(w->strings.end(), s, s + wcslen(s) + 1);
+    return index;
+}
+
+static FILE *_open_write(const wchar_t *filename)
+{
+#ifdef _WIN32
+    FILE *f = NULL;
+    if (_wfopen_s(&f, filename, L"wb") != 0)
+    {
+        return NULL;
+    }
+    return f;
+#else
+    char path[4096];
+    if (wcstombs(path, filename, sizeof(path)) >= sizeof(path))
+    {
+        return NULL;
+    }
+    return fopen(path, "wb");
+#endif
+}
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+int project_cache_key(const wchar_t *xmlfilename, unsigned long long *key)
+{
+    MAPPED_FILE_T mf;
+    if (file_map(xmlfilename, &mf) != 0)
+    {
+        return -1;
+    }
+
+    *key = _hash(mf.data, mf.size);
+    file_unmap(&mf);
+    return 0;
+}
+
+PROJECT_CACHE_T *project_cache_open(const wchar_t *filename, unsigned long long key)
+{
+    PROJECT_CACHE_T *cache = (PROJECT_CACHE_T *)calloc(1, sizeof(PROJECT_CACHE_T));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    if (file_map(filename, &cache->mf) != 0)
+    {
+        free(cache);
+        return NULL;
+    }
+
+    const CACHE_HEADER_T *h = (const CACHE_HEADER_T *)cache->mf.data;
+    if ((cache->mf.size < sizeof(CACHE_HEADER_T))
+            || (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0)
+            || (h->version != PROJECT_CACHE_VERSION)
+            || (h->wchar_size != sizeof(wchar_t))
+            || (h->key != key)
+            || (_cache_size(h) != cache->mf.size))
+    {
+        project_cache_close(cache);
+        return NULL;
+    }
+
+    cache->header = h;
+    cache->materials = (const CACHE_MATERIAL_T *)(h + 1);
+    cache->details = (const CACHE_DETAIL_T *)(cache->materials + h->materials_cnt);
+    cache->operations = (const CACHE_OPERATION_T *)(cache->details + h->details_cnt);
+    cache->strings = (const wchar_t *)(cache->operations + h->operations_cnt);
+
+    if (!_cache_valid(cache))
+    {
+        printf("Project cache is damaged, ignored\n");
+        project_cache_close(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void project_cache_close(PROJECT_CACHE_T *cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    file_unmap(&cache->mf);
+    free(cache);
+}
+
+int project_cache_stream(PROJECT_CACHE_T *cache, VIYAR_PROJECT_T *project, detail_cb cb, void *data)
+{
+    const CACHE_HEADER_T *h = cache->header;
+
+    if ((h->materials_cnt > INT_MAX) || (h->details_cnt > INT_MAX))
+    {
+        return E_ABORT;
+    }
+
+    project->materials = (MATERIAL_DEF_T *)malloc(MAX(h->materials_cnt, 1) * sizeof(MATERIAL_DEF_T));
+    if (project->materials == NULL)
+    {
+        return E_ABORT;
+    }
+    project->materials_size = MAX(h->materials_cnt, 1);
+    project->materials_cnt = h->materials_cnt;
+
+    for (unsigned int i = 0; i < h->materials_cnt; i++)
+    {
+        project->materials[i].type = (MATERIAL_TYPE_T)cache->materials[i].type;
+        project->materials[i].thickness = cache->materials[i].thickness;
+    }
+
+    for (unsigned int i = 0; i < h->details_cnt; i++)
+    {
+        const CACHE_DETAIL_T *cd = &cache->details[i];
+        DETAIL_DEF_T d;
+        memset(&d, 0, sizeof(d));
+
+        d.id = cd->id;
+        d.name = _cache_string(cache, cd->name);
+        d.material_id = cd->material_id;
+        d.width = cd->width;
+        d.height = cd->height;
+        d.thickness = cd->thickness;
+        d.multiplicity = cd->multiplicity;
+        d.grain = cd->grain;
+        d.amount = (size_t)cd->amount;
+        memcpy(d.m_bands, cd->m_bands, sizeof(d.m_bands));
+
+        if (cd->operations_cnt > 0)
+        {
+            OPERATION_T *ops = (OPERATION_T *)malloc(cd->operations_cnt * sizeof(OPERATION_T));
+            if (ops == NULL)
+            {
+                return E_ABORT;
+            }
+
+            for (unsigned int j = 0; j < cd->operations_cnt; j++)
+            {
+                const CACHE_OPERATION_T *co = &cache->operations[cd->operations + j];
+                OPERATION_T *op = &ops[j];
+
+                op->type = (OPERATION_TYPE_T)co->type;
+                op->side = co->side;
+                op->corner = co->corner;
+                op->x = co->x;
+                op->y = co->y;
+                op->xo = co->xo;
+                op->yo = co->yo;
+                op->d = co->d;
+                op->depth = co->depth;
+                op->millD = co->millD;
+                op->r = co->r;
+                op->mill = co->mill;
+                op->ext = co->ext;
+                op->edgeMaterial = co->edgeMaterial;
+                op->edgeCovering = co->edgeCovering;
+                op->xl = _cache_string(cache, co->xl);
+                op->yl = _cache_string(cache, co->yl);
+                op->subtype = co->subtype;
+            }
+
+            d.operations = ops;
+            d.operations_cnt = cd->operations_cnt;
+            d.storage = ops;
+        }
+
+        project->details_cnt++;
+
+        // Ownership of the detail goes to the callback
+        HRESULT hr = cb(&d, project, data);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+    }
+
+    return S_OK;
+}
+
+PROJECT_CACHE_WRITER_T *project_cache_writer_create()
+{
+    PROJECT_CACHE_WRITER_T *w = new PROJECT_CACHE_WRITER_T;
+    w->strings.push_back(0);
+    return w;
+}
+
+void project_cache_writer_destroy(PROJECT_CACHE_WRITER_T *w)
+{
+    delete w;
+}
+
+int project_cache_writer_add(PROJECT_CACHE_WRITER_T *w, const DETAIL_DEF_T *detail)
+{
+    CACHE_DETAIL_T cd;
+    memset(&cd, 0, sizeof(cd));
+
+    cd.id = detail->id;
+    cd.material_id = detail->material_id;
+    cd.width = detail->width;
+    cd.height = detail->height;
+    cd.thickness = detail->thickness;
+    cd.multiplicity = detail->multiplicity;
+    cd.grain = detail->grain;
+    cd.amount = detail->amount;
+    memcpy(cd.m_bands, detail->m_bands, sizeof(cd.m_bands));
+    cd.name = _writer_string(w, detail->name);
+    cd.operations = (unsigned int)w->operations.size();
+    cd.operations_cnt = (unsigned int)detail->operations_cnt;
+
+    for (size_t j = 0; j < detail->operations_cnt; j++)
+    {
+        const OPERATION_T *op = &detail->operations[j];
+        CACHE_OPERATION_T co;
+        memset(&co, 0, sizeof(co));
+
+        co.type = op->type;
+        co.side = op->side;
+        co.corner = op->corner;
+        co.mill = op->mill;
+        co.ext = op->ext;
+        co.edgeMaterial = op->edgeMaterial;
+        co.edgeCovering = op->edgeCovering;
+        co.subtype = op->subtype;
+        co.x = op->x;
+        co.y = op->y;
+        co.xo = op->xo;
+        co.yo = op->yo;
+        co.d = op->d;
+        co.depth = op->depth;
+        co.millD = op->millD;
+        co.r = op->r;
+        co.xl = _writer_string(w, op->xl);
+        co.yl = _writer_string(w, op->yl);
+        w->operations.push_back(co);
+    }
+
+    w->details.push_back(cd);
+
+    // Indexes are 32 bit in the file
+    if ((w->operations.size() > UINT_MAX) || (w->strings.size() > UINT_MAX))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int project_cache_writer_save(PROJECT_CACHE_WRITER_T *w, const VIYAR_PROJECT_T *project,
+                              const wchar_t *filename, unsigned long long key)
+{
+    std::vector<CACHE_MATERIAL_T> materials(project->materials_cnt);
+    for (int i = 0; i < project->materials_cnt; i++)
+    {
+        memset(&materials[i], 0, sizeof(CACHE_MATERIAL_T));
+        materials[i].type = project->materials[i].type;
+        materials[i].thickness = project->materials[i].thickness;
+    }
+
+    CACHE_HEADER_T h;
+    memset(&h, 0, sizeof(h));
+    h.version = PROJECT_CACHE_VERSION;
+    h.wchar_size = sizeof(wchar_t);
+    h.materials_cnt = (unsigned int)materials.size();
+    h.key = key;
+    h.details_cnt = (unsigned int)w->details.size();
+    h.operations_cnt = (unsigned int)w->operations.size();
+    h.strings_cnt = (unsigned int)w->strings.size();
+
+    FILE *f = _open_write(filename);
+    if (f == NULL)
+    {
+        return -1;
+    }
+
+    // Magic is written last, cache interrupted while writing is never used
+    bool ok = (fwrite(&h, sizeof(h), 1, f) == 1)
+        && (fwrite(materials.data(), sizeof(CACHE_MATERIAL_T), materials.size(), f) == materials.size())
+        && (fwrite(w->details.data(), sizeof(CACHE_DETAIL_T), w->details.size(), f) == w->details.size())
+        && (fwrite(w->operations.data(), sizeof(CACHE_OPERATION_T), w->operations.size(), f) == w->operations.size())
+        && (fwrite(w->strings.data(), sizeof(wchar_t), w->strings.size(), f) == w->strings.size());
+
+    if (ok)
+    {
+        memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+        ok = (fflush(f) == 0) && (fseek(f, 0, SEEK_SET) == 0) && (fwrite(&h, sizeof(h), 1, f) == 1);
+    }
+
+    if (fclose(f) != 0)
+    {
+        ok = false;
+    }
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "viyar.h"
+
+/***************************************************************/
+/*                     Global Definitions                      */
+/***************************************************************/
+
+/* Cache of a project is kept next to it: <project file> + PROJECT_CACHE_EXT */
+#define PROJECT_CACHE_EXT L".vpc"
+
+/* Stored in cache header, bump when cache layout or parse results change
+ * so caches written by older builds are ignored */
+#define PROJECT_CACHE_VERSION 1
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+/* Memory-mapped parsed project: flat arrays of materials, details and
+ * operations referencing each other and a string table by index */
+typedef struct PROJECT_CACHE PROJECT_CACHE_T;
+
+/* Collects parsed details for project_cache_writer_save() */
+typedef struct PROJECT_CACHE_WRITER PROJECT_CACHE_WRITER_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+/* Hash of project file content, caches are keyed by it */
+int project_cache_key(const wchar_t *xmlfilename, unsigned long long *key /* out */);
+
+/* NULL if cache is missing, was written for other content (key differs),
+ * by incompatible build or is damaged */
+PROJECT_CACHE_T *project_cache_open(const wchar_t *filename, unsigned long long key);
+void project_cache_close(PROJECT_CACHE_T *cache);
+
+/* Same contract as parse_xml_stream(). Only operations of each detail are
+ * allocated, names and operation strings point into the mapped cache,
+ * so it has to stay open until all details are released */
+int project_cache_stream(PROJECT_CACHE_T *cache, VIYAR_PROJECT_T *project /* out */, detail_cb cb, void *data);
+
+PROJECT_CACHE_WRITER_T *project_cache_writer_create();
+void project_cache_writer_destroy(PROJECT_CACHE_WRITER_T *w);
+
+/* Details have to be added in project order */
+int project_cache_writer_add(PROJECT_CACHE_WRITER_T *w, const DETAIL_DEF_T *detail);
+
+/* Write materials of project and all added details, key is project_cache_key() of the source */
+int project_cache_writer_save(PROJECT_CACHE_WRITER_T *w, const VIYAR_PROJECT_T *project,
+                              const wchar_t *filename, unsigned long long key);
@@ -0,0 +1,180 @@
+#include "tess.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#include <atomic>
+#include <mutex>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define TESS_SSE2
+#include <emmintrin.h>
+#endif
+
+/***************************************************************/
+/*                     Local Definitions                       */
+/***************************************************************/
+
+#define TESS_PI 3.14159265358979323846
+
+/***************************************************************/
+/*                     Local Variables                         */
+/***************************************************************/
+
+static std::atomic<const TESS_TABLE_T *> _tables[TESS_MAX_SEGMENTS + 1];
+static std::mutex _tables_lock;
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+static const TESS_TABLE_T *_table_create(size_t num_segments)
+{
+    size_t padded = (num_segments + 1) & ~(size_t)1;
+
+    // Table and both arrays in one block, released at exit
+    size_t size = sizeof(TESS_TABLE_T) + 16 + 2 * padded * sizeof(double);
+    unsigned char *block = (unsigned char *)calloc(1, size);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    TESS_TABLE_T *t = (TESS_TABLE_T *)block;
+    double *c = (double *)(((size_t)(block + sizeof(TESS_TABLE_T)) + 15) & ~(size_t)15);
+    double *s = c + padded;
+
+    for (size_t i = 0; i < num_segments; i++)
+    {
+        double a = 2 * TESS_PI * i / num_segments;
+        c[i] = cos(a);
+        s[i] = sin(a);
+    }
+
+    // Exact values on the axes keep shared points bit-identical
+    static const double axis_cos[4] = {1, 0, -1, 0};
+    static const double axis_sin[4] = {0, 1, 0, -1};
+    for (size_t q = 0; q < 4; q++)
+    {
+        if ((q * num_segments) % 4 == 0)
+        {
+            c[q * num_segments / 4] = axis_cos[q];
+            s[q * num_segments / 4] = axis_sin[q];
+        }
+    }
+
+    t->num_segments = num_segments;
+    t->cos = c;
+    t->sin = s;
+    return t;
+}
+
+/* out[i] = center + r*(cos[i]*u + sin[i]*v) for i in [first, first + count) of table */
+static void _tess_points(const TESS_TABLE_T *t, const GEOM_POINT_T *u, const GEOM_POINT_T *v,
+                         const TESS_CIRCLE_T *circle, size_t first, size_t count, GEOM_POINT_T *out)
+{
+    const double *c = t->cos + first;
+    const double *s = t->sin + first;
+    const double r = circle->r;
+    size_t i = 0;
+
+#ifdef TESS_SSE2
+    const __m128d cx = _mm_set1_pd(circle->center.x);
+    const __m128d cy = _mm_set1_pd(circle->center.y);
+    const __m128d cz = _mm_set1_pd(circle->center.z);
+    const __m128d rux = _mm_set1_pd(r * u->x);
+    const __m128d ruy = _mm_set1_pd(r * u->y);
+    const __m128d ruz = _mm_set1_pd(r * u->z);
+    const __m128d rvx = _mm_set1_pd(r * v->x);
+    const __m128d rvy = _mm_set1_pd(r * v->y);
+    const __m128d rvz = _mm_set1_pd(r * v->z);
+
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128d cc = _mm_loadu_pd(c + i);
+        __m128d ss = _mm_loadu_pd(s + i);
+
+        __m128d x = _mm_add_pd(cx, _mm_add_pd(_mm_mul_pd(cc, rux), _mm_mul_pd(ss, rvx)));
+        __m128d y = _mm_add_pd(cy, _mm_add_pd(_mm_mul_pd(cc, ruy), _mm_mul_pd(ss, rvy)));
+        __m128d z = _mm_add_pd(cz, _mm_add_pd(_mm_mul_pd(cc, ruz), _mm_mul_pd(ss, rvz)));
+
+        // GEOM_POINT_T is {x, y, z}: pairs (x0, y0), (z0, x1), (y1, z1)
+        double *dst = &out[i].x;
+        _mm_storeu_pd(dst, _mm_unpacklo_pd(x, y));
+        _mm_storeu_pd(dst + 2, _mm_shuffle_pd(z, x, 2));
+        _mm_storeu_pd(dst + 4, _mm_unpackhi_pd(y, z));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        out[i].x = circle->center.x + (c[i] * (r * u->x) + s[i] * (r * v->x));
+        out[i].y = circle->center.y + (c[i] * (r * u->y) + s[i] * (r * v->y));
+        out[i].z = circle->center.z + (c[i] * (r * u->z) + s[i] * (r * v->z));
+    }
+}
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+const TESS_TABLE_T *tess_table(size_t num_segments)
+{
+    if ((num_segments < 3) || (num_segments > TESS_MAX_SEGMENTS))
+    {
+        return NULL;
+    }
+
+    const TESS_TABLE_T *t = _tables[num_segments].load(std::memory_order_acquire);
+    if (t)
+    {
+        return t;
+    }
+
+    std::lock_guard<std::mutex> guard(_tables_lock);
+    t = _tables[num_segments].load(std::memory_order_relaxed);
+    if (t == NULL)
+    {
+        t = _table_create(num_segments);
+        _tables[num_segments].store(t, std::memory_order_release);
+    }
+    return t;
+}
+
+void tess_plane(const GEOM_POINT_T *normal, GEOM_POINT_T *u, GEOM_POINT_T *v)
+{
+    GEOM_POINT_T origin = {0, 0, 0};
+    geom_circle_start(&origin, normal, 1.0, u);
+
+    v->x = normal->y * u->z - normal->z * u->y;
+    v->y = normal->z * u->x - normal->x * u->z;
+    v->z = normal->x * u->y - normal->y * u->x;
+}
+
+void tess_circles(const TESS_TABLE_T *t, const GEOM_POINT_T *u, const GEOM_POINT_T *v,
+                  const TESS_CIRCLE_T *circles, size_t num_circles, GEOM_POINT_T *out)
+{
+    for (size_t i = 0; i < num_circles; i++)
+    {
+        _tess_points(t, u, v, &circles[i], 0, t->num_segments, out + i * t->num_segments);
+    }
+}
+
+size_t tess_arc(const TESS_TABLE_T *t, const GEOM_POINT_T *u, const GEOM_POINT_T *v,
+                const TESS_CIRCLE_T *circle, size_t first, size_t count, GEOM_POINT_T *out)
+{
+    size_t n = t->num_segments;
+    size_t num_points = MIN(count, n) + 1;
+
+    first %= n;
+    size_t done = 0;
+    while (done < num_points)
+    {
+        // Contiguous run up to the end of the table
+        size_t run = MIN(num_points - done, n - first);
+        _tess_points(t, u, v, circle, first, run, out + done);
+        done += run;
+        first = 0;
+    }
+    return num_points;
+}
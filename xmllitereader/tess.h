@@ -0,0 +1,49 @@
+#pragma once
+
+#include "geometry.h"
+
+/***************************************************************/
+/*                     Global Definitions                      */
+/***************************************************************/
+
+#define TESS_MAX_SEGMENTS 1024
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+/* Unit circle, point i is at angle 2*pi*i/num_segments.
+ * Arrays are padded to an even length for SIMD */
+typedef struct {
+    size_t num_segments;
+    const double *cos;
+    const double *sin;
+} TESS_TABLE_T;
+
+/* Circle of radius r around center in plane (u, v), u and v are unit and
+ * orthogonal; point 0 is at center + r*u */
+typedef struct {
+    GEOM_POINT_T center;
+    double r;
+} TESS_CIRCLE_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+/* Cached per segment count and never released, safe to call from any thread.
+ * NULL if num_segments is outside 3..TESS_MAX_SEGMENTS */
+const TESS_TABLE_T *tess_table(size_t num_segments);
+
+/* Plane for circles with the given normal, u matches geom_circle_start() */
+void tess_plane(const GEOM_POINT_T *normal, GEOM_POINT_T *u /* out */, GEOM_POINT_T *v /* out */);
+
+/* Tessellate num_circles circles sharing plane (u, v), e.g. all holes on one
+ * panel side: out receives num_circles * t->num_segments points, circle by circle */
+void tess_circles(const TESS_TABLE_T *t, const GEOM_POINT_T *u, const GEOM_POINT_T *v,
+                  const TESS_CIRCLE_T *circles, size_t num_circles, GEOM_POINT_T *out);
+
+/* Arc of a circle from point first to point first + count (inclusive, indices
+ * wrap around), count + 1 points. A quarter arc (fillet) is count = num_segments / 4 */
+size_t tess_arc(const TESS_TABLE_T *t, const GEOM_POINT_T *u, const GEOM_POINT_T *v,
+                const TESS_CIRCLE_T *circle, size_t first, size_t count, GEOM_POINT_T *out);
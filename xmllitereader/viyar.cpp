@@ -1,26 +1,30 @@
 #include "viyar.h"
+#include "xmlsax.h"
 
-#include <ole2.h>
-#include <xmllite.h>
 #include <stdio.h>
-#include <shlwapi.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+
+#include <thread>
+#include <vector>
 
 /***************************************************************/
 /*                     Local Definitions                       */
 /***************************************************************/
 
+#ifdef _MSC_VER
 #pragma warning(disable : 4127)  // conditional expression is constant
-#define CHKHR(stmt)             do { hr = (stmt); if (FAILED(hr)) goto CleanUp; } while(0)
-#define HR(stmt)                do { hr = (stmt); printf("HR line %d\n", __LINE__);goto CleanUp; } while(0)
-#define SAFE_RELEASE(I)         do { if (I){ I->Release(); } I = NULL; } while(0)
+#endif
+
+/* Keyword perfect hash: TOKEN_HASH_SIZE slots, collisions are rejected at compile time */
+#define TOKEN_HASH_SIZE 128
+#define TOKEN_HASH(len, first, middle, last) \
+    (((len) * 7 + (first) * 19 + (last) * 11 + (middle)) & (TOKEN_HASH_SIZE - 1))
 
 /***************************************************************/
 /*                       Local Types                           */
 /***************************************************************/
-typedef HRESULT (*attribute_cb)(const WCHAR* elementName,
-                                const WCHAR* LocalName,
-                                const WCHAR* Value,
-                                void *data);
 
 typedef enum {
     STATE_ROOT = 0,
@@ -41,15 +45,393 @@ typedef enum {
     DETAIL_OPERATIONS
 } DETAIL_STATE_T;
 
+/* Element, attribute and enumerated value names of Viyar projects */
+typedef enum {
+    TOKEN_UNKNOWN = 0,
+    //elements
+    TOKEN_PROJECT,
+    TOKEN_MATERIALS,
+    TOKEN_MATERIAL,     //also detail attribute
+    TOKEN_DETAILS,
+    TOKEN_DETAIL,
+    TOKEN_EDGES,
+    TOKEN_EDGE,
+    TOKEN_OPERATIONS,
+    TOKEN_OPERATION,
+    TOKEN_LEFT,
+    TOKEN_TOP,
+    TOKEN_RIGHT,
+    TOKEN_BOTTOM,
+    //attributes
+    TOKEN_ID,
+    TOKEN_TYPE,
+    TOKEN_THICKNESS,
+    TOKEN_AMOUNT,
+    TOKEN_WIDTH,
+    TOKEN_HEIGHT,
+    TOKEN_MULTIPLICITY,
+    TOKEN_DESCRIPTION,
+    TOKEN_GRAIN,
+    TOKEN_JOINT,
+    TOKEN_PARAM,
+    TOKEN_SUBTYPE,
+    TOKEN_XL,
+    TOKEN_YL,
+    TOKEN_X,
+    TOKEN_Y,
+    TOKEN_XO,
+    TOKEN_YO,
+    TOKEN_D,
+    TOKEN_R,
+    TOKEN_DEPTH,
+    TOKEN_MILLD,
+    TOKEN_SIDE,
+    TOKEN_CORNER,
+    TOKEN_MILL,
+    TOKEN_EXT,
+    TOKEN_EDGEMATERIAL,
+    TOKEN_EDGECOVERING,
+    //values
+    TOKEN_SHEET,
+    TOKEN_BAND,
+    TOKEN_KROMKA,
+    TOKEN_DRILLING,
+    TOKEN_SHAPEBYPATTERN,
+    TOKEN_RABBETING,
+    TOKEN_GROOVING,
+    TOKEN_CORNEROPERATION,
+    TOKEN_MAX
+} VIYAR_TOKEN_T;
+
+typedef struct {
+    const char *name;
+    size_t len;
+    VIYAR_TOKEN_T token;
+} VIYAR_KEYWORD_T;
+
+/* Keyword index + 1 by hash, 0 = empty slot */
+typedef struct {
+    unsigned char slot[TOKEN_HASH_SIZE];
+    bool valid; //no two keywords share a slot
+} VIYAR_TOKEN_TABLE_T;
+
+/* Parser context - all state of one parse_xml() call, no globals */
+typedef struct {
+    VIYAR_STATE_T state;
+    MODEL_STATE_T model_state;
+    DETAIL_STATE_T detail_state;
+    VIYAR_TOKEN_T element;  //current element, attributes follow its start
+    bool number_error;      //malformed numeric value in current attribute
+    bool number_empty;      //empty numeric value in current attribute, read as 0
+    VIYAR_PROJECT_T *p;
+    detail_cb on_detail;    //streaming mode if set
+    void *on_detail_data;
+    DETAIL_DEF_T detail;    //detail being parsed in streaming mode
+    bool detail_open;       //detail points to scratch storage below
+    OPERATION_T *ops;       //operations of current detail, reused for all details
+    size_t ops_size;
+    ARENA_T strings;        //strings of current detail
+    long id_base;           //detail id attribute is id_base + position in p->details
+    bool id_base_known;     //false in parallel chunk until its first detail id is read
+} VIYAR_PARSER_T;
+
+/* Run of whole <detail> elements parsed on its own thread into own project,
+ * materials are shared read-only with the main project */
+typedef struct {
+    const char *buf;
+    size_t size;
+    VIYAR_PROJECT_T project;
+    VIYAR_PARSER_T ctx;
+    HRESULT hr;
+} VIYAR_CHUNK_T;
+
 /***************************************************************/
 /*                     Local Variables                         */
 /***************************************************************/
 
-static VIYAR_STATE_T _state = STATE_ROOT;
-static MODEL_STATE_T _model_state = MODEL_NONE;
-static DETAIL_STATE_T _detail_state = DETAIL_ATTR;
+#define KEYWORD(name, token) { name, sizeof(name) - 1, token }
+
+static constexpr VIYAR_KEYWORD_T _keywords[] = {
+    KEYWORD("project",          TOKEN_PROJECT),
+    KEYWORD("materials",        TOKEN_MATERIALS),
+    KEYWORD("material",         TOKEN_MATERIAL),
+    KEYWORD("details",          TOKEN_DETAILS),
+    KEYWORD("detail",           TOKEN_DETAIL),
+    KEYWORD("edges",            TOKEN_EDGES),
+    KEYWORD("edge",             TOKEN_EDGE),
+    KEYWORD("operations",       TOKEN_OPERATIONS),
+    KEYWORD("operation",        TOKEN_OPERATION),
+    KEYWORD("left",             TOKEN_LEFT),
+    KEYWORD("top",              TOKEN_TOP),
+    KEYWORD("right",            TOKEN_RIGHT),
+    KEYWORD("bottom",           TOKEN_BOTTOM),
+    KEYWORD("id",               TOKEN_ID),
+    KEYWORD("type",             TOKEN_TYPE),
+    KEYWORD("thickness",        TOKEN_THICKNESS),
+    KEYWORD("amount",           TOKEN_AMOUNT),
+    KEYWORD("width",            TOKEN_WIDTH),
+    KEYWORD("height",           TOKEN_HEIGHT),
+    KEYWORD("multiplicity",     TOKEN_MULTIPLICITY),
+    KEYWORD("description",      TOKEN_DESCRIPTION),
+    KEYWORD("grain",            TOKEN_GRAIN),
+    KEYWORD("joint",            TOKEN_JOINT),
+    KEYWORD("param",            TOKEN_PARAM),
+    KEYWORD("subtype",          TOKEN_SUBTYPE),
+    KEYWORD("xl",               TOKEN_XL),
+    KEYWORD("yl",               TOKEN_YL),
+    KEYWORD("x",                TOKEN_X),
+    KEYWORD("y",                TOKEN_Y),
+    KEYWORD("xo",               TOKEN_XO),
+    KEYWORD("yo",               TOKEN_YO),
+    KEYWORD("d",                TOKEN_D),
+    KEYWORD("r",                TOKEN_R),
+    KEYWORD("depth",            TOKEN_DEPTH),
+    KEYWORD("millD",            TOKEN_MILLD),
+    KEYWORD("side",             TOKEN_SIDE),
+    KEYWORD("corner",           TOKEN_CORNER),
+    KEYWORD("mill",             TOKEN_MILL),
+    KEYWORD("ext",              TOKEN_EXT),
+    KEYWORD("edgeMaterial",     TOKEN_EDGEMATERIAL),
+    KEYWORD("edgeCovering",     TOKEN_EDGECOVERING),
+    KEYWORD("sheet",            TOKEN_SHEET),
+    KEYWORD("band",             TOKEN_BAND),
+    KEYWORD("kromka",           TOKEN_KROMKA),
+    KEYWORD("drilling",         TOKEN_DRILLING),
+    KEYWORD("shapeByPattern",   TOKEN_SHAPEBYPATTERN),
+    KEYWORD("rabbeting",        TOKEN_RABBETING),
+    KEYWORD("grooving",         TOKEN_GROOVING),
+    KEYWORD("cornerOperation",  TOKEN_CORNEROPERATION),
+};
+
+#undef KEYWORD
+
+#define KEYWORDS_CNT (sizeof(_keywords) / sizeof(_keywords[0]))
+
+static constexpr size_t _token_hash(const char *s, size_t len)
+{
+    return TOKEN_HASH(len, (unsigned char)s[0], (unsigned char)s[len / 2], (unsigned char)s[len - 1]);
+}
+
+static constexpr VIYAR_TOKEN_TABLE_T _token_table_build()
+{
+    VIYAR_TOKEN_TABLE_T t = {};
+    t.valid = true;
+    for (size_t i = 0; i < KEYWORDS_CNT; i++)
+    {
+        size_t h = _token_hash(_keywords[i].name, _keywords[i].len);
+        if (t.slot[h] != 0)
+        {
+            t.valid = false;
+        }
+        t.slot[h] = (unsigned char)(i + 1);
+    }
+    return t;
+}
+
+static constexpr VIYAR_TOKEN_TABLE_T _token_table = _token_table_build();
+
+static_assert(_token_table.valid, "keyword hash collision - change TOKEN_HASH constants");
+static_assert(KEYWORDS_CNT == TOKEN_MAX - 1, "every token needs a keyword");
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+/* One hash and one compare instead of a strcmp chain per attribute */
+static inline VIYAR_TOKEN_T _token(const XML_VIEW_T *v)
+{
+    if (v->len == 0)
+    {
+        return TOKEN_UNKNOWN;
+    }
+
+    unsigned char k = _token_table.slot[_token_hash(v->ptr, v->len)];
+    if (k == 0)
+    {
+        return TOKEN_UNKNOWN;
+    }
+
+    const VIYAR_KEYWORD_T *kw = &_keywords[k - 1];
+    if ((kw->len != v->len) || (memcmp(kw->name, v->ptr, v->len) != 0))
+    {
+        return TOKEN_UNKNOWN;
+    }
+    return kw->token;
+}
+
+static void _parser_init(VIYAR_PARSER_T *ctx, VIYAR_PROJECT_T *project, detail_cb cb, void *data)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->state = STATE_ROOT;
+    ctx->model_state = MODEL_NONE;
+    ctx->detail_state = DETAIL_ATTR;
+    ctx->p = project;
+    ctx->on_detail = cb;
+    ctx->on_detail_data = data;
+    ctx->id_base = 0;
+    ctx->id_base_known = true;
+}
+
+static DETAIL_DEF_T *_current_detail(VIYAR_PARSER_T *ctx)
+{
+    if (ctx->on_detail)
+    {
+        return &ctx->detail;
+    }
+    return &ctx->p->details[ctx->p->details_cnt-1];
+}
+
+static void _parser_free(VIYAR_PARSER_T *ctx)
+{
+    // Detail left unfinished by parse error points to scratch storage
+    if (ctx->detail_open)
+    {
+        DETAIL_DEF_T *d = _current_detail(ctx);
+        d->name = NULL;
+        d->operations = NULL;
+        d->operations_cnt = 0;
+    }
+    free(ctx->ops);
+    ctx->ops = NULL;
+    arena_free(&ctx->strings);
+}
+
+/* Detail number for messages, chunk of parallel parse counts from its first id */
+static int _detail_number(const VIYAR_PARSER_T *ctx)
+{
+    return ctx->p->details_cnt + (int)ctx->id_base;
+}
+
+/* Geometric growth, *size is number of allocated elements */
+static bool _grow(void **array, int *size, int cnt, size_t element_size)
+{
+    if (cnt <= *size)
+    {
+        return true;
+    }
+
+    int new_size = MAX(*size * 2, 16);
+    void *new_array = realloc(*array, new_size * element_size);
+    if (new_array == NULL)
+    {
+        return false;
+    }
+
+    *array = new_array;
+    *size = new_size;
+    return true;
+}
+
+static wchar_t *_scratch_wcs(VIYAR_PARSER_T *ctx, const XML_VIEW_T *v)
+{
+    wchar_t *s = (wchar_t *)arena_alloc(&ctx->strings, (v->len + 1) * sizeof(wchar_t));
+    if (s)
+    {
+        xml_view_decode(v, s);
+    }
+    return s;
+}
+
+static size_t _wcs_size(const wchar_t *s)
+{
+    return s ? (wcslen(s) + 1) * sizeof(wchar_t) : 0;
+}
+
+static wchar_t *_wcs_copy(unsigned char **dst, const wchar_t *s)
+{
+    if (s == NULL)
+    {
+        return NULL;
+    }
+
+    size_t size = _wcs_size(s);
+    wchar_t *copy = (wchar_t *)*dst;
+    memcpy(copy, s, size);
+    *dst += size;
+    return copy;
+}
+
+/* Move operations and strings of finished detail from scratch storage into one
+ * exact-size block: project arena, or malloc'ed block owned by the detail in
+ * streaming mode */
+static HRESULT _detail_finalize(VIYAR_PARSER_T *ctx, DETAIL_DEF_T *d)
+{
+    size_t ops_size = d->operations_cnt * sizeof(OPERATION_T);
+    size_t size = ops_size + _wcs_size(d->name);
+    for (size_t i = 0; i < d->operations_cnt; i++)
+    {
+        size += _wcs_size(d->operations[i].xl) + _wcs_size(d->operations[i].yl);
+    }
+
+    unsigned char *block = NULL;
+    if (size > 0)
+    {
+        block = ctx->on_detail ? (unsigned char *)malloc(size)
+                               : (unsigned char *)arena_alloc(&ctx->p->arena, size);
+        if (block == NULL)
+        {
+            PARSE_FAIL(E_ABORT);
+        }
+    }
+
+    unsigned char *dst = block + ops_size;
+    OPERATION_T *ops = (d->operations_cnt > 0) ? (OPERATION_T *)block : NULL;
+    for (size_t i = 0; i < d->operations_cnt; i++)
+    {
+        ops[i] = d->operations[i];
+        ops[i].xl = _wcs_copy(&dst, d->operations[i].xl);
+        ops[i].yl = _wcs_copy(&dst, d->operations[i].yl);
+    }
+
+    d->operations = ops;
+    d->name = _wcs_copy(&dst, d->name);
+    d->storage = ctx->on_detail ? block : NULL;
+
+    arena_reset(&ctx->strings);
+    ctx->detail_open = false;
+    return S_OK;
+}
+
+/* Numeric attribute values, a malformed value is reported by _sax_attribute().
+ * Empty value reads as 0 as it always did, with a warning */
+static long _to_long(VIYAR_PARSER_T *ctx, const XML_VIEW_T *v)
+{
+    long value = 0;
+    if (xml_view_blank(v))
+    {
+        ctx->number_empty = true;
+    }
+    else if (xml_view_to_long(v, &value) != NUM_OK)
+    {
+        ctx->number_error = true;
+    }
+    return value;
+}
+
+static int _to_int(VIYAR_PARSER_T *ctx, const XML_VIEW_T *v)
+{
+    long value = _to_long(ctx, v);
+    if ((value < INT_MIN) || (value > INT_MAX))
+    {
+        ctx->number_error = true;
+        return 0;
+    }
+    return (int)value;
+}
 
-VIYAR_PROJECT_T *p = NULL;
+static double _to_double(VIYAR_PARSER_T *ctx, const XML_VIEW_T *v)
+{
+    double value = 0;
+    if (xml_view_blank(v))
+    {
+        ctx->number_empty = true;
+    }
+    else if (xml_view_to_double(v, &value) != NUM_OK)
+    {
+        ctx->number_error = true;
+    }
+    return value;
+}
 
 static HRESULT _model_open_create()
 {
@@ -63,60 +445,63 @@ static HRESULT _model_save_close()
     return S_OK;
 }
 
-static HRESULT _element_start(const WCHAR* ElementName, void *data)
+static HRESULT _element_start(VIYAR_PARSER_T *ctx, VIYAR_TOKEN_T element)
 {
-    //wprintf(L"S %d: Element start (%p) <%s ...\n", _state, data, ElementName);
+    VIYAR_PROJECT_T *p = ctx->p;
+
+    //wprintf(L"S %d: Element start (%p) <%s ...\n", ctx->state, ctx, ElementName);
 
-    switch (_state)
+    switch (ctx->state)
     {
         case STATE_ROOT:
-            if (wcscmp(ElementName, L"project") == 0)
-            {
-                if (_model_state == MODEL_NONE)
-                {
-                    _model_state = MODEL_OPENED;
-                    _model_open_create();
-                }
-            }
-            else if (wcscmp(ElementName, L"materials") == 0)
-            {
-                if (_model_state != MODEL_OPENED)
-                {
-                    PARSE_FAIL(E_ABORT);
-                }
-                _state = STATE_MATERIALS;
-                if (p->materials_cnt != 0)
-                {
-                    PARSE_FAIL(E_ABORT);
-                }
-            }
-            else if (wcscmp(ElementName, L"details") == 0)
-            {
-                if (_model_state != MODEL_OPENED)
-                {
-                    PARSE_FAIL(E_ABORT);
-                }
-                _state = STATE_DETAILS;
-                if (p->details_cnt != 0)
-                {
-                    PARSE_FAIL(E_ABORT);
-                }
-            }
-            else
+            switch (element)
             {
-                // Ignore
+                case TOKEN_PROJECT:
+                    if (ctx->model_state == MODEL_NONE)
+                    {
+                        ctx->model_state = MODEL_OPENED;
+                        _model_open_create();
+                    }
+                    break;
+
+                case TOKEN_MATERIALS:
+                    if (ctx->model_state != MODEL_OPENED)
+                    {
+                        PARSE_FAIL(E_ABORT);
+                    }
+                    ctx->state = STATE_MATERIALS;
+                    if (p->materials_cnt != 0)
+                    {
+                        PARSE_FAIL(E_ABORT);
+                    }
+                    break;
+
+                case TOKEN_DETAILS:
+                    if (ctx->model_state != MODEL_OPENED)
+                    {
+                        PARSE_FAIL(E_ABORT);
+                    }
+                    ctx->state = STATE_DETAILS;
+                    if (p->details_cnt != 0)
+                    {
+                        PARSE_FAIL(E_ABORT);
+                    }
+                    break;
+
+                default:
+                    // Ignore
+                    break;
             }
             break;
 
         case STATE_MATERIALS:
-            if (wcscmp(ElementName, L"material") == 0)
+            if (element == TOKEN_MATERIAL)
             {
-                p->materials_cnt++;
-                p->materials = (MATERIAL_DEF_T*)realloc(p->materials, sizeof(MATERIAL_DEF_T)*p->materials_cnt);
-                if (p->materials == NULL)
+                if (!_grow((void **)&p->materials, &p->materials_size, p->materials_cnt + 1, sizeof(MATERIAL_DEF_T)))
                 {
                     PARSE_FAIL(E_ABORT);
                 }
+                p->materials_cnt++;
 
                 MATERIAL_DEF_T *m = &p->materials[p->materials_cnt-1];
                 memset(m, 0, sizeof(MATERIAL_DEF_T));
@@ -130,66 +515,79 @@ static HRESULT _element_start(const WCHAR* ElementName, void *data)
             break;
 
         case STATE_DETAILS:
-            if (wcscmp(ElementName, L"detail") == 0)
+            switch (element)
             {
-
-                p->details_cnt++;
-                p->details = (DETAIL_DEF_T*)realloc(p->details, sizeof(DETAIL_DEF_T)*p->details_cnt);
-                if (p->details == NULL)
+                case TOKEN_DETAIL:
                 {
-                    PARSE_FAIL(E_ABORT);
-                }
+                    if (!ctx->on_detail)
+                    {
+                        if (!_grow((void **)&p->details, &p->details_size, p->details_cnt + 1, sizeof(DETAIL_DEF_T)))
+                        {
+                            PARSE_FAIL(E_ABORT);
+                        }
+                    }
+                    p->details_cnt++;
 
-                DETAIL_DEF_T *d = &p->details[p->details_cnt-1];
-                memset(d, 0, sizeof(DETAIL_DEF_T));
+                    DETAIL_DEF_T *d = _current_detail(ctx);
+                    memset(d, 0, sizeof(DETAIL_DEF_T));
+                    d->id = p->details_cnt;
+                    ctx->detail_open = true;
 
-                _detail_state = DETAIL_ATTR;
+                    ctx->detail_state = DETAIL_ATTR;
 
-                for (size_t i = 0 ; i < 6; i++)
-                {
-                    //Set default material for all bands = material 1
-                    d->m_bands[i] = 1;
+                    for (size_t i = 0 ; i < 6; i++)
+                    {
+                        //Set default material for all bands = material 1
+                        d->m_bands[i] = 1;
+                    }
+                    break;
                 }
-                //wprintf(L"_detail_state = DETAIL_ATTR\n");
-//                wprintf(L"TODO: (%d) start adding detail\n", _details_cnt);
-            }
-            else
-            {
-                //wprintf(L"TODO: (%d:%s) continue updating detail\n", _details_cnt, ElementName);
 
-                if (wcscmp(ElementName, L"edges") == 0)
-                {
-                    _detail_state = DETAIL_EDGES;
-                    //wprintf(L"_detail_state = DETAIL_EDGES\n");
-                }
-                else if (wcscmp(ElementName, L"edge") == 0)
-                {
-                    if (_detail_state != DETAIL_EDGES)
+                case TOKEN_EDGES:
+                    ctx->detail_state = DETAIL_EDGES;
+                    break;
+
+                case TOKEN_EDGE:
+                    if (ctx->detail_state != DETAIL_EDGES)
                     {
                         PARSE_FAIL(E_ABORT);
                     }
-                }
-                else if (wcscmp(ElementName, L"operations") == 0)
-                {
-                    _detail_state = DETAIL_OPERATIONS;
-                    //wprintf(L"_detail_state = DETAIL_OPERATIONS\n");
-                }
-                else if (wcscmp(ElementName, L"operation") == 0)
+                    break;
+
+                case TOKEN_OPERATIONS:
+                    ctx->detail_state = DETAIL_OPERATIONS;
+                    break;
+
+                case TOKEN_OPERATION:
                 {
-                    if (_detail_state != DETAIL_OPERATIONS)
+                    if (ctx->detail_state != DETAIL_OPERATIONS)
                     {
                         PARSE_FAIL(E_ABORT);
                     }
 
-                    DETAIL_DEF_T *d = &p->details[p->details_cnt-1];
+                    DETAIL_DEF_T *d = _current_detail(ctx);
 
-                    d->operations_cnt++;
-                    d->operations = (OPERATION_T*)realloc(d->operations, sizeof(OPERATION_T)*d->operations_cnt);
-                    if (d->operations == NULL)
+                    if (d->operations_cnt == ctx->ops_size)
                     {
-                        PARSE_FAIL(E_ABORT);
+                        size_t new_size = MAX(ctx->ops_size * 2, 16);
+                        OPERATION_T *ops = (OPERATION_T*)realloc(ctx->ops, sizeof(OPERATION_T)*new_size);
+                        if (ops == NULL)
+                        {
+                            PARSE_FAIL(E_ABORT);
+                        }
+                        ctx->ops = ops;
+                        ctx->ops_size = new_size;
                     }
+
+                    d->operations = ctx->ops;
+                    d->operations_cnt++;
+                    memset(&d->operations[d->operations_cnt-1], 0, sizeof(OPERATION_T));
+                    break;
                 }
+
+                default:
+                    //wprintf(L"TODO: (%d:%s) continue updating detail\n", _details_cnt, ElementName);
+                    break;
             }
             break;
 
@@ -200,43 +598,53 @@ static HRESULT _element_start(const WCHAR* ElementName, void *data)
     return S_OK;
 }
 
-static HRESULT _element_end(const WCHAR* ElementName, void *data)
+static HRESULT _element_end(VIYAR_PARSER_T *ctx, VIYAR_TOKEN_T element)
 {
-    //wprintf(L"S %d: End element </%s> (%p)\n", _state, ElementName, data);
+    //wprintf(L"S %d: End element </%s> (%p)\n", ctx->state, ElementName, ctx);
 
-    switch (_state)
+    switch (ctx->state)
     {
         case STATE_ROOT:
-            if (wcscmp(ElementName, L"project") == 0)
+            if (element == TOKEN_PROJECT)
             {
-                if (_model_state == MODEL_OPENED)
+                if (ctx->model_state == MODEL_OPENED)
                 {
-                    _model_state = MODEL_CLOSED;
+                    ctx->model_state = MODEL_CLOSED;
                     _model_save_close();
                 }
             }
             break;
 
         case STATE_MATERIALS:
-
-            if (wcscmp(ElementName, L"material") == 0)
+            if (element == TOKEN_MATERIALS)
             {
-                //wprintf(L"TODO: add material (%d) to Model\n", _materials_cnt);
-            }
-            else if (wcscmp(ElementName, L"materials") == 0)
-            {
-                _state = STATE_ROOT;
+                ctx->state = STATE_ROOT;
             }
             break;
 
         case STATE_DETAILS:
-            if (wcscmp(ElementName, L"detail") == 0)
+            if (element == TOKEN_DETAIL)
             {
-                //wprintf(L"TODO: add detail (%d) to Model\n", _details_cnt);
+                HRESULT hr = _detail_finalize(ctx, _current_detail(ctx));
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+
+                if (ctx->on_detail)
+                {
+                    // Ownership of the detail goes to the callback
+                    HRESULT hr = ctx->on_detail(&ctx->detail, ctx->p, ctx->on_detail_data);
+                    memset(&ctx->detail, 0, sizeof(ctx->detail));
+                    if (FAILED(hr))
+                    {
+                        PARSE_FAIL(hr);
+                    }
+                }
             }
-            else if (wcscmp(ElementName, L"details") == 0)
+            else if (element == TOKEN_DETAILS)
             {
-                _state = STATE_ROOT;
+                ctx->state = STATE_ROOT;
             }
             break;
 
@@ -247,93 +655,286 @@ static HRESULT _element_end(const WCHAR* ElementName, void *data)
     return S_OK;
 }
 
-static HRESULT _parse_declaration(const WCHAR* ElementName,
-                                  const WCHAR* LocalName,
-                                  const WCHAR* Value,
-                                  void *data)
+static HRESULT _parse_material(VIYAR_PARSER_T *ctx,
+                               VIYAR_TOKEN_T attribute,
+                               const XML_VIEW_T *Value)
 {
-    wprintf(L"declaration %s=\"%s\"> (%p)\n", LocalName, Value, data);
-
-    return S_OK;
-}
+    VIYAR_PROJECT_T *p = ctx->p;
 
-static HRESULT _parse_material(const WCHAR* ElementName,
-                               const WCHAR* LocalName,
-                               const WCHAR* Value,
-                               void *data)
-{
     if (p->materials_cnt < 1)
     {
         PARSE_FAIL(E_ABORT);
     }
 
-    if (wcscmp(ElementName, L"material") != 0)
+    if (ctx->element != TOKEN_MATERIAL)
     {
         return S_FALSE;
     }
 
     MATERIAL_DEF_T *m = &p->materials[p->materials_cnt-1];
 
-    if (wcscmp(LocalName, L"id") == 0)
+    switch (attribute)
     {
-        if (_wtol(Value) != p->materials_cnt)
-        {
-            PARSE_FAIL(E_ABORT);
-        }
+        case TOKEN_ID:
+            if (_to_long(ctx, Value) != p->materials_cnt)
+            {
+                PARSE_FAIL(E_ABORT);
+            }
+            break;
+
+        case TOKEN_TYPE:
+            switch (_token(Value))
+            {
+                case TOKEN_SHEET:
+                    m->type = TYPE_SHEET;
+                    break;
+                case TOKEN_BAND:
+                    m->type = TYPE_BAND;
+                    break;
+                default:
+                    PARSE_FAIL(E_ABORT);
+            }
+            break;
+
+        case TOKEN_THICKNESS:
+            m->thickness = _to_double(ctx, Value);
+            if (m->thickness == 0.0)
+            {
+                PARSE_FAIL(E_ABORT);
+            }
+            break;
+
+        // markingColor is ignored since files have incorrect values in it
+
+        default:
+            //wprintf(L"Ignore attribute material (%d) %s=\"%s\"\n", _materials_cnt, LocalName, Value);
+            return S_FALSE;
     }
-    else if (wcscmp(LocalName, L"type") == 0)
+
+    return S_OK;
+}
+
+static HRESULT _parse_detail_attr(VIYAR_PARSER_T *ctx, DETAIL_DEF_T *d,
+                                  VIYAR_TOKEN_T attribute,
+                                  const XML_VIEW_T *LocalName,
+                                  const XML_VIEW_T *Value)
+{
+    VIYAR_PROJECT_T *p = ctx->p;
+
+    switch (attribute)
     {
-        if (wcscmp(Value, L"sheet") == 0)
+        case TOKEN_ID:
         {
-            m->type = TYPE_SHEET;
+            long id = _to_long(ctx, Value);
+            if (!ctx->id_base_known)
+            {
+                //Parallel chunk does not know how many details precede it,
+                //the base is checked when chunks are joined
+                ctx->id_base = id - p->details_cnt;
+                ctx->id_base_known = true;
+            }
+            if (id != ctx->id_base + p->details_cnt)
+            {
+                PARSE_FAIL(E_ABORT);
+            }
+            break;
         }
-        else if (wcscmp(Value, L"band") == 0)
+
+        case TOKEN_MATERIAL:
         {
-            m->type = TYPE_BAND;
+            d->material_id = _to_int(ctx, Value);
+            if ((d->material_id <= 0) || (d->material_id > p->materials_cnt))
+            {
+                PARSE_FAIL(E_ABORT);
+            }
+            // TODO: update thickness after reading multiplier
+            MATERIAL_DEF_T *m = &p->materials[d->material_id-1];
+            d->thickness = m->thickness;
+            break;
         }
-        else
+
+        case TOKEN_AMOUNT:
+            d->amount = _to_long(ctx, Value);
+            if (d->amount <= 0)
+            {
+                printf("Warning: " XML_VIEW_FMT " = " XML_VIEW_FMT "\n", XML_VIEW_ARG(LocalName), XML_VIEW_ARG(Value));
+            }
+            break;
+
+        case TOKEN_WIDTH:
+            d->width = _to_double(ctx, Value);
+            if (d->width <= 0.0)
+            {
+                PARSE_FAIL(E_ABORT);
+            }
+            break;
+
+        case TOKEN_HEIGHT:
+            d->height = _to_double(ctx, Value);
+            if (d->height <= 0.0)
+            {
+                PARSE_FAIL(E_ABORT);
+            }
+            break;
+
+        case TOKEN_MULTIPLICITY:
+            d->multiplicity = _to_int(ctx, Value);
+            if (d->multiplicity <= 0)
+            {
+                PARSE_FAIL(E_ABORT);
+            }
+            break;
+
+        case TOKEN_DESCRIPTION:
+            if (Value->len > 0)
+            {
+                // set name for non-empty components only.
+                d->name = _scratch_wcs(ctx, Value);
+            }
+            break;
+
+        case TOKEN_GRAIN:
+            d->grain = _to_int(ctx, Value);
+            break;
+
+        default:
+            //wprintf(L"Ignore attribute %s (%d) %s=\"%s\"\n", ElementName, _details_cnt, LocalName, Value);
+            return S_FALSE;
+    }
+
+    return S_OK;
+}
+
+static HRESULT _parse_detail_edge(VIYAR_PARSER_T *ctx, DETAIL_DEF_T *d,
+                                  VIYAR_TOKEN_T attribute,
+                                  const XML_VIEW_T *Value)
+{
+    VIYAR_PROJECT_T *p = ctx->p;
+
+    if (attribute == TOKEN_TYPE)
+    {
+        //Limit kromka and empty only for now
+        if ((_token(Value) != TOKEN_KROMKA) &&
+                (Value->len != 0))
         {
             PARSE_FAIL(E_ABORT);
         }
     }
-    else if (wcscmp(LocalName, L"thickness") == 0)
+    else if (attribute == TOKEN_PARAM)
     {
-        m->thickness = _wtof(Value);
-        if (m->thickness == 0.0)
+        // Goes with empty type: no band
+        int material_id = xml_view_blank(Value) ? 0 : _to_int(ctx, Value);
+        if ((material_id < 0) || (material_id > p->materials_cnt))
         {
             PARSE_FAIL(E_ABORT);
         }
-    }
-/* Ignore since incorrect values in markingColor
-    else if (wcscmp(LocalName, L"markingColor") == 0)
-    {
-        int red, green, blue;
-        if (swscanf_s(Value, L"rgb(%d,%d,%d)", &red, &green, &blue) != 3)
+        else if (material_id > 0)
         {
-            PARSE_FAIL(E_ABORT);
+            MATERIAL_DEF_T *m = &p->materials[material_id-1];
+
+            switch (ctx->element)
+            {
+                case TOKEN_TOP:
+                    d->m_bands[SIDE_TOP] = material_id;
+                    d->height += m->thickness;
+                    break;
+                case TOKEN_BOTTOM:
+                    d->m_bands[SIDE_BOTTOM] = material_id;
+                    d->height += m->thickness;
+                    break;
+                case TOKEN_LEFT:
+                    d->m_bands[SIDE_LEFT] = material_id;
+                    d->width += m->thickness;
+                    break;
+                case TOKEN_RIGHT:
+                    d->m_bands[SIDE_RIGHT] = material_id;
+                    d->width += m->thickness;
+                    break;
+                default:
+                    break;
+            }
         }
+        else
+        {
+            //Do not update default value in d->m_bands
+        }
+    }
+
+    return S_OK;
+}
 
-        m->color.red = red;
-        m->color.green = green;
-        m->color.blue = blue;
-        m->color.alpha = DEFAULT_COLOR_ALPHA_BAND;
+static HRESULT _parse_operation(VIYAR_PARSER_T *ctx, DETAIL_DEF_T *d,
+                                VIYAR_TOKEN_T attribute,
+                                const XML_VIEW_T *LocalName,
+                                const XML_VIEW_T *Value)
+{
+    if (d->operations_cnt == 0)
+    {
+        PARSE_FAIL(E_ABORT);
     }
-*/
-    else
+
+    OPERATION_T * op = &d->operations[d->operations_cnt-1];
+
+    switch (attribute)
     {
-        //wprintf(L"Ignore attribute material (%d) %s=\"%s\"\n", _materials_cnt, LocalName, Value);
-        return S_FALSE;
+        case TOKEN_ID:
+            if (_to_long(ctx, Value) != d->operations_cnt)
+            {
+                PARSE_FAIL(E_ABORT);
+            }
+            break;
+
+        case TOKEN_TYPE:
+            switch (_token(Value))
+            {
+                case TOKEN_DRILLING:            op->type = TYPE_DRILLING; break;
+                case TOKEN_SHAPEBYPATTERN:      op->type = TYPE_SHAPEBYPATTERN; break;
+                case TOKEN_RABBETING:           op->type = TYPE_RABBETING; break;
+                case TOKEN_GROOVING:            op->type = TYPE_GROOVING; break;
+                case TOKEN_CORNEROPERATION:     op->type = TYPE_CORNEROPERATION; break;
+                default:
+                    printf("Ignore operation (%d) " XML_VIEW_FMT "=\"" XML_VIEW_FMT "\"\n",
+                           _detail_number(ctx), XML_VIEW_ARG(LocalName), XML_VIEW_ARG(Value));
+                    return S_FALSE;
+            }
+            break;
+
+        case TOKEN_SUBTYPE:         op->subtype = _to_int(ctx, Value); break;
+        case TOKEN_XL:              op->xl = _scratch_wcs(ctx, Value); break;
+        case TOKEN_YL:              op->yl = _scratch_wcs(ctx, Value); break;
+        case TOKEN_X:               op->x = _to_double(ctx, Value); break;
+        case TOKEN_Y:               op->y = _to_double(ctx, Value); break;
+        case TOKEN_XO:              op->xo = _to_double(ctx, Value); break;
+        case TOKEN_YO:              op->yo = _to_double(ctx, Value); break;
+        case TOKEN_D:               op->d = _to_double(ctx, Value); break;
+        case TOKEN_R:               op->r = _to_double(ctx, Value); break;
+        case TOKEN_DEPTH:           op->depth = _to_double(ctx, Value); break;
+        case TOKEN_MILLD:           op->millD = _to_double(ctx, Value); break;
+        case TOKEN_SIDE:            op->side = _to_int(ctx, Value); break;
+        case TOKEN_CORNER:          op->corner = _to_int(ctx, Value); break;
+        case TOKEN_MILL:            op->mill = _to_int(ctx, Value); break;
+        case TOKEN_EXT:             op->ext = _to_int(ctx, Value); break;
+        case TOKEN_EDGEMATERIAL:    op->edgeMaterial = _to_int(ctx, Value); break;
+        case TOKEN_EDGECOVERING:    op->edgeCovering = _to_int(ctx, Value); break;
+
+        default:
+            printf("Ignore attribute operation (%d) " XML_VIEW_FMT "=\"" XML_VIEW_FMT "\"\n",
+                   _detail_number(ctx), XML_VIEW_ARG(LocalName), XML_VIEW_ARG(Value));
+            return S_FALSE;
     }
 
     return S_OK;
 }
 
-static HRESULT _parse_detail(const WCHAR* ElementName,
-                             const WCHAR* LocalName,
-                             const WCHAR* Value,
-                             void *data)
+static HRESULT _parse_detail(VIYAR_PARSER_T *ctx,
+                             const XML_VIEW_T *ElementName,
+                             VIYAR_TOKEN_T attribute,
+                             const XML_VIEW_T *LocalName,
+                             const XML_VIEW_T *Value)
 {
-    if (wcscmp(ElementName, L"details") == 0)
+    VIYAR_PROJECT_T *p = ctx->p;
+
+    if (ctx->element == TOKEN_DETAILS)
     {
         //Skip <details> attributes
         return S_FALSE;
@@ -344,315 +945,79 @@ static HRESULT _parse_detail(const WCHAR* ElementName,
         PARSE_FAIL(E_ABORT);
     }
 
-    DETAIL_DEF_T *d = &p->details[p->details_cnt-1];
+    DETAIL_DEF_T *d = _current_detail(ctx);
 
-    //wprintf(L"detail %d:%d <%s: %s=\"%s\"> (%p)\n", _details_cnt, _detail_state, ElementName, LocalName, Value, data);
+    //wprintf(L"detail %d:%d <%s: %s=\"%s\"> (%p)\n", _details_cnt, ctx->detail_state, ElementName, LocalName, Value, ctx);
 
-    switch (_detail_state)
+    switch (ctx->detail_state)
     {
         case DETAIL_ATTR:
-            if (wcscmp(ElementName, L"detail") == 0)
+            if (ctx->element == TOKEN_DETAIL)
             {
-                if (wcscmp(LocalName, L"id") == 0)
-                {
-                    if (_wtol(Value) != p->details_cnt)
-                    {
-                        PARSE_FAIL(E_ABORT);
-                    }
-                }
-                else if (wcscmp(LocalName, L"material") == 0)
-                {
-                    d->material_id = _wtol(Value);
-                    if ((d->material_id <= 0) || (d->material_id > p->materials_cnt))
-                    {
-                        PARSE_FAIL(E_ABORT);
-                    }
-                    // TODO: update thickness after reading multiplier
-                    MATERIAL_DEF_T *m = &p->materials[d->material_id-1];
-                    d->thickness = m->thickness;
-                }
-                else if (wcscmp(LocalName, L"amount") == 0)
-                {
-                    d->amount = _wtol(Value);
-                    if (d->amount <= 0)
-                    {
-                        wprintf(L"Warning: %s = %s\n", LocalName, Value);
-                    }
-                }
-                else if (wcscmp(LocalName, L"width") == 0)
-                {
-                    d->width = _wtof(Value);
-                    if (d->width <= 0.0)
-                    {
-                        PARSE_FAIL(E_ABORT);
-                    }
-                }
-                else if (wcscmp(LocalName, L"height") == 0)
-                {
-                    d->height = _wtof(Value);
-                    if (d->height <= 0.0)
-                    {
-                        PARSE_FAIL(E_ABORT);
-                    }
-                }
-                else if (wcscmp(LocalName, L"multiplicity") == 0)
-                {
-                    d->multiplicity = _wtol(Value);
-                    if (d->multiplicity <= 0)
-                    {
-                        PARSE_FAIL(E_ABORT);
-                    }
-                }
-                else if (wcscmp(LocalName, L"description") == 0)
-                {
-                    //wprintf(L"description='%s'\n", Value);
-                    if (wcslen(Value) > 0)
-                    {
-                        // set name for non-empty components only.
-                        d->name = _wcsdup(Value);
-                    }
-                }
-                else if (wcscmp(LocalName, L"grain") == 0)
-                {
-                    d->grain = _wtol(Value);
-                }
-                else
-                {
-                    //wprintf(L"Ignore attribute %s (%d) %s=\"%s\"\n", ElementName, _details_cnt, LocalName, Value);
-                    return S_FALSE;
-                }
-            }
-            else
-            {
-                wprintf(L"Ignore detail element %s (%d) %s=\"%s\"\n", ElementName, p->details_cnt, LocalName, Value);
-                return S_FALSE;
+                return _parse_detail_attr(ctx, d, attribute, LocalName, Value);
             }
             break;
 
         case DETAIL_EDGES:
-            if (wcscmp(ElementName, L"edges") == 0)
+            switch (ctx->element)
             {
-                if (wcscmp(LocalName, L"joint") == 0)
-                {
-                    //Always "0" in my files
-                    if (wcscmp(Value, L"0") != 0)
-                    {
-                        PARSE_FAIL(E_ABORT);
-                    }
-                }
-            }
-            else if ((wcscmp(ElementName, L"left") == 0) ||
-                     (wcscmp(ElementName, L"top") == 0) ||
-                     (wcscmp(ElementName, L"right") == 0) ||
-                     (wcscmp(ElementName, L"bottom") == 0))
-            {
-                if (wcscmp(LocalName, L"type") == 0)
-                {
-                    //Limit kromka and empty only for now
-                    if ((wcscmp(Value, L"kromka") != 0) &&
-                            (wcscmp(Value, L"") != 0))
-                    {
-                        PARSE_FAIL(E_ABORT);
-                    }
-                }
-                else if (wcscmp(LocalName, L"param") == 0)
-                {
-                    int material_id = _wtol(Value);
-                    if (material_id < 0)
-                    {
-                        PARSE_FAIL(E_ABORT);
-                    }
-                    else if (material_id > 0)
+                case TOKEN_EDGES:
+                    if (attribute == TOKEN_JOINT)
                     {
-                        MATERIAL_DEF_T *m = &p->materials[material_id-1];
-
-                        if (wcscmp(ElementName, L"top") == 0)
-                        {
-                            d->m_bands[SIDE_TOP] = material_id;
-                            d->height += m->thickness;
-                        }
-                        else if (wcscmp(ElementName, L"bottom") == 0)
-                        {
-                            d->m_bands[SIDE_BOTTOM] = material_id;
-                            d->height += m->thickness;
-                        }
-                        else if (wcscmp(ElementName, L"left") == 0)
+                        //Always "0" in my files
+                        if (!XML_VIEW_EQ(Value, "0"))
                         {
-                            d->m_bands[SIDE_LEFT] = material_id;
-                            d->width += m->thickness;
-                        }
-                        else if (wcscmp(ElementName, L"right") == 0)
-                        {
-                            d->m_bands[SIDE_RIGHT] = material_id;
-                            d->width += m->thickness;
+                            PARSE_FAIL(E_ABORT);
                         }
                     }
-                    else
-                    {
-                        //Do not update default value in d->m_bands
-                    }
-                }
-            }
-            else
-            {
-                wprintf(L"Ignore detail element %s (%d) %s=\"%s\"\n", ElementName, p->details_cnt, LocalName, Value);
-                return S_FALSE;
+                    return S_OK;
+
+                case TOKEN_LEFT:
+                case TOKEN_TOP:
+                case TOKEN_RIGHT:
+                case TOKEN_BOTTOM:
+                    return _parse_detail_edge(ctx, d, attribute, Value);
+
+                default:
+                    break;
             }
             break;
 
         case DETAIL_OPERATIONS:
-            if (wcscmp(ElementName, L"operations") == 0)
+            if (ctx->element == TOKEN_OPERATIONS)
             {
                 // No attributes
+                return S_OK;
             }
-            else if (wcscmp(ElementName, L"operation") == 0)
+            else if (ctx->element == TOKEN_OPERATION)
             {
-
-                if (d->operations_cnt == 0)
-                {
-                    PARSE_FAIL(E_ABORT);
-                }
-
-                OPERATION_T * op = &d->operations[d->operations_cnt-1];
-
-                if (wcscmp(LocalName, L"id") == 0)
-                {
-                    if (_wtol(Value) != d->operations_cnt)
-                    {
-                        PARSE_FAIL(E_ABORT);
-                    }
-                }
-                else if (wcscmp(LocalName, L"type") == 0)
-                {
-                    if (wcscmp(Value, L"drilling") == 0)
-                    {
-                        op->type = TYPE_DRILLING;
-                    }
-                    else if (wcscmp(Value, L"shapeByPattern") == 0)
-                    {
-                        op->type = TYPE_SHAPEBYPATTERN;
-                    }
-                    else if (wcscmp(Value, L"rabbeting") == 0)
-                    {
-                        op->type = TYPE_RABBETING;
-                    }
-                    else if (wcscmp(Value, L"grooving") == 0)
-                    {
-                        op->type = TYPE_GROOVING;
-                    }
-                    else if (wcscmp(Value, L"cornerOperation") == 0)
-                    {
-                        op->type = TYPE_CORNEROPERATION;
-                    }
-                    else
-                    {
-                        wprintf(L"Ignore operation (%d) %s=\"%s\"\n", p->details_cnt, LocalName, Value);
-                        return S_FALSE;
-                    }
-                }
-                else if (wcscmp(LocalName, L"subtype") == 0)
-                {
-                    //op->subtype = _wcsdup(Value);
-                    op->subtype = _wtol(Value);
-                }
-                else if (wcscmp(LocalName, L"xl") == 0)
-                {
-                    op->xl = _wcsdup(Value);
-                }
-                else if (wcscmp(LocalName, L"yl") == 0)
-                {
-                    op->yl = _wcsdup(Value);
-                }
-                else if (wcscmp(LocalName, L"x") == 0)
-                {
-                    op->x = _wtof(Value);
-                }
-                else if (wcscmp(LocalName, L"y") == 0)
-                {
-                    op->y = _wtof(Value);
-                }
-                else if (wcscmp(LocalName, L"xo") == 0)
-                {
-                    op->xo = _wtof(Value);
-                }
-                else if (wcscmp(LocalName, L"yo") == 0)
-                {
-                    op->yo = _wtof(Value);
-                }
-                else if (wcscmp(LocalName, L"d") == 0)
-                {
-                    op->d = _wtof(Value);
-                }
-                else if (wcscmp(LocalName, L"r") == 0)
-                {
-                    op->r = _wtof(Value);
-                }
-                else if (wcscmp(LocalName, L"depth") == 0)
-                {
-                    op->depth = _wtof(Value);
-                }
-                else if (wcscmp(LocalName, L"millD") == 0)
-                {
-                    op->millD = _wtof(Value);
-                }
-                else if (wcscmp(LocalName, L"side") == 0)
-                {
-                    op->side = _wtol(Value);
-                }
-                else if (wcscmp(LocalName, L"corner") == 0)
-                {
-                    op->corner = _wtol(Value);
-                }
-                else if (wcscmp(LocalName, L"mill") == 0)
-                {
-                    op->mill = _wtol(Value);
-                }
-                else if (wcscmp(LocalName, L"ext") == 0)
-                {
-                    op->ext = _wtol(Value);
-                }
-                else if (wcscmp(LocalName, L"edgeMaterial") == 0)
-                {
-                    op->edgeMaterial = _wtol(Value);
-                }
-                else if (wcscmp(LocalName, L"edgeCovering") == 0)
-                {
-                    op->edgeCovering = _wtol(Value);
-                }
-                else
-                {
-                    wprintf(L"Ignore attribute %s (%d) %s=\"%s\"\n", ElementName, p->details_cnt, LocalName, Value);
-                    return S_FALSE;
-                }
-            }
-            else
-            {
-                wprintf(L"Ignore detail element %s (%d) %s=\"%s\"\n", ElementName, p->details_cnt, LocalName, Value);
-                return S_FALSE;
+                return _parse_operation(ctx, d, attribute, LocalName, Value);
             }
             break;
     }
 
-    return S_OK;
+    printf("Ignore detail element " XML_VIEW_FMT " (%d) " XML_VIEW_FMT "=\"" XML_VIEW_FMT "\"\n",
+           XML_VIEW_ARG(ElementName), _detail_number(ctx), XML_VIEW_ARG(LocalName), XML_VIEW_ARG(Value));
+    return S_FALSE;
 }
 
 
-static HRESULT _parse_element(const WCHAR* ElementName,
-                              const WCHAR* LocalName,
-                              const WCHAR* Value,
-                              void *data)
+static HRESULT _parse_element(VIYAR_PARSER_T *ctx,
+                              const XML_VIEW_T *ElementName,
+                              const XML_VIEW_T *LocalName,
+                              const XML_VIEW_T *Value)
 {
-    //wprintf(L"<%s %s=\"%s\"> (%p)\n", ElementName, LocalName, Value, data);
+    //wprintf(L"<%s %s=\"%s\"> (%p)\n", ElementName, LocalName, Value, ctx);
 
-    if (_state == STATE_MATERIALS)
+    if (ctx->state == STATE_MATERIALS)
     {
-        return _parse_material(ElementName, LocalName, Value, data);
+        return _parse_material(ctx, _token(LocalName), Value);
     }
-    else if (_state == STATE_DETAILS)
+    else if (ctx->state == STATE_DETAILS)
     {
-        return _parse_detail(ElementName, LocalName, Value, data);
+        return _parse_detail(ctx, ElementName, _token(LocalName), LocalName, Value);
     }
-    else if (_state == STATE_ROOT)
+    else if (ctx->state == STATE_ROOT)
     {
         //return S_FALSE in ROOT state
         return S_FALSE;
@@ -661,246 +1026,315 @@ static HRESULT _parse_element(const WCHAR* ElementName,
     PARSE_FAIL(E_ABORT);
 }
 
-HRESULT WriteAttributes(IXmlReader* pReader, const WCHAR* ElementName, attribute_cb cb, void *data)
+static int _sax_element_start(const XML_VIEW_T *ElementName, void *data)
 {
-    const WCHAR* pwszPrefix;
-    const WCHAR* pwszLocalName;
-    const WCHAR* pwszValue;
+    VIYAR_PARSER_T *ctx = (VIYAR_PARSER_T *)data;
 
-    HRESULT hr = _element_start(ElementName, data);
+    // Resolved once, all attributes of the element dispatch on it
+    ctx->element = _token(ElementName);
 
-    if (S_OK != hr)
+    HRESULT hr = _element_start(ctx, ctx->element);
+    if (FAILED(hr))
     {
-        wprintf(L"Callback returned error (%d)\n", hr);
-        return hr;
+        printf("Callback returned error (%d)\n", hr);
     }
+    return hr;
+}
 
-    hr = pReader->MoveToFirstAttribute();
+static int _sax_attribute(const XML_VIEW_T *ElementName,
+                          const XML_VIEW_T *LocalName,
+                          const XML_VIEW_T *Value,
+                          void *data)
+{
+    VIYAR_PARSER_T *ctx = (VIYAR_PARSER_T *)data;
 
-    if (S_FALSE == hr)
-        return hr;
-    if (S_OK != hr)
+    ctx->number_error = false;
+    ctx->number_empty = false;
+    HRESULT hr = _parse_element(ctx, ElementName, LocalName, Value);
+    if (!FAILED(hr) && ctx->number_error)
     {
-        wprintf(L"Error moving to first attribute, error is %08.8lx", hr);
-        return hr;
+        printf("Invalid number " XML_VIEW_FMT "=\"" XML_VIEW_FMT "\" in " XML_VIEW_FMT " (detail %d)\n",
+               XML_VIEW_ARG(LocalName), XML_VIEW_ARG(Value), XML_VIEW_ARG(ElementName), _detail_number(ctx));
+        hr = E_ABORT;
     }
-    else
+    else if (!FAILED(hr) && ctx->number_empty)
     {
-        do
-        {
-            if (!pReader->IsDefault())
-            {
-                UINT cwchPrefix;
-                if (FAILED(hr = pReader->GetPrefix(&pwszPrefix, &cwchPrefix)))
-                {
-                    wprintf(L"Error getting prefix, error is %08.8lx", hr);
-                    return hr;
-                }
-                if (FAILED(hr = pReader->GetLocalName(&pwszLocalName, NULL)))
-                {
-                    wprintf(L"Error getting local name, error is %08.8lx", hr);
-                    return hr;
-                }
-                if (FAILED(hr = pReader->GetValue(&pwszValue, NULL)))
-                {
-                    wprintf(L"Error getting value, error is %08.8lx", hr);
-                    return hr;
-                }
-                /*
-                                if (cwchPrefix > 0)
-                                    wprintf(L"%s Attr: %s:%s=\"%s\" \n", ElementName, pwszPrefix, pwszLocalName, pwszValue);
-                                else
-                                    wprintf(L"%s Attr: %s=\"%s\" \n", ElementName, pwszLocalName, pwszValue);
-                */
-                if (cb)
-                {
-                    if (FAILED(hr = cb(ElementName, pwszLocalName, pwszValue, data)))
-                    {
-                        wprintf(L"Callback returned error (%d)\n", hr);
-                        return hr;
-                    }
-                }
-            }
-        } while (pReader->MoveToNextAttribute() == S_OK);
+        printf("Empty number " XML_VIEW_FMT " in " XML_VIEW_FMT " (detail %d) - read as 0\n",
+               XML_VIEW_ARG(LocalName), XML_VIEW_ARG(ElementName), _detail_number(ctx));
+    }
+    if (FAILED(hr))
+    {
+        printf("Callback returned error (%d)\n", hr);
     }
     return hr;
 }
 
-int parse_xml(const wchar_t* xmlfilename, VIYAR_PROJECT_T *project /* out */)
+static int _sax_element_end(const XML_VIEW_T *ElementName, void *data)
 {
-    HRESULT hr = S_OK;
-    IStream *pFileStream = NULL;
-    IXmlReader *pReader = NULL;
-    IXmlReaderInput *xmlReaderInput = NULL;
-    XmlNodeType nodeType;
-    const wchar_t* pwszPrefix;
-    const wchar_t* pwszLocalName;
-    const wchar_t* pwszValue;
-    UINT cwchPrefix;
-
-    p = project;
+    return _element_end((VIYAR_PARSER_T *)data, _token(ElementName));
+}
 
-    //Open read-only input stream
-    if (FAILED(hr = SHCreateStreamOnFile(xmlfilename, STGM_READ, &pFileStream)))
+static HRESULT _sax_parse(VIYAR_PARSER_T *ctx, const char *buf, size_t size)
+{
+    XML_SAX_CB_T sax_cb = {
+        _sax_element_start,
+        _sax_attribute,
+        _sax_element_end,
+    };
+
+    HRESULT hr = xml_sax_parse(buf, size, &sax_cb, ctx);
+    if (FAILED(hr))
     {
-        wprintf(L"Error creating file reader, error is %08.8lx", hr);
-        HR(hr);
+        printf("Error parsing project file, error is %08x\n", (unsigned)hr);
     }
+    return hr;
+}
 
-    if (FAILED(hr = CreateXmlReader(__uuidof(IXmlReader), (void**) &pReader, NULL)))
+static bool _is_tag_end(char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == '>') || (c == '/');
+}
+
+/* Position of tag ("<name" or "</name" followed by end of name) in [pos, size),
+ * size if none. Plain text search is enough for <details> content: Viyar
+ * writes no comments or CDATA there, and '<' can not appear in attribute values */
+static size_t _find_tag(const char *buf, size_t size, size_t pos, const char *tag, size_t tag_len)
+{
+    while (pos + tag_len < size)
     {
-        wprintf(L"Error creating xml reader, error is %08.8lx", hr);
-        HR(hr);
+        const char *lt = (const char *)memchr(buf + pos, '<', size - tag_len - pos);
+        if (lt == NULL)
+        {
+            break;
+        }
+        pos = lt - buf;
+        if ((memcmp(buf + pos, tag, tag_len) == 0) && _is_tag_end(buf[pos + tag_len]))
+        {
+            return pos;
+        }
+        pos++;
     }
+    return size;
+}
 
-    if (FAILED(hr = CreateXmlReaderInputWithEncodingName(pFileStream, nullptr, L"windows-1251", FALSE,
-                    L"c:\temp", &xmlReaderInput)))
+/* Last position of tag in buf, size if none */
+static size_t _rfind_tag(const char *buf, size_t size, const char *tag, size_t tag_len)
+{
+    if (size <= tag_len)
     {
-        wprintf(L"Error creating xml reader with encoding code page, error is %08.8lx", hr);
-        HR(hr);
+        return size;
     }
 
-    if (FAILED(hr = pReader->SetProperty(XmlReaderProperty_DtdProcessing, DtdProcessing_Prohibit)))
+    for (size_t pos = size - tag_len; pos > 0; )
     {
-        wprintf(L"Error setting XmlReaderProperty_DtdProcessing, error is %08.8lx", hr);
-        HR(hr);
+        pos--;
+        if ((buf[pos] == '<') && (memcmp(buf + pos, tag, tag_len) == 0) && _is_tag_end(buf[pos + tag_len]))
+        {
+            return pos;
+        }
     }
+    return size;
+}
 
-    if (FAILED(hr = pReader->SetInput(xmlReaderInput)))
+static void _parse_chunk(VIYAR_CHUNK_T *c)
+{
+    c->hr = _sax_parse(&c->ctx, c->buf, c->size);
+    _parser_free(&c->ctx);
+}
+
+/* Append details of parsed chunks to project in document order */
+static HRESULT _join_chunks(VIYAR_PROJECT_T *project, std::vector<VIYAR_CHUNK_T> &chunks)
+{
+    int details_cnt = 0;
+
+    for (size_t i = 0; i < chunks.size(); i++)
     {
-        wprintf(L"Error setting input for reader, error is %08.8lx", hr);
-        HR(hr);
+        VIYAR_CHUNK_T *c = &chunks[i];
+        if (FAILED(c->hr))
+        {
+            return c->hr;
+        }
+
+        //Ids have to continue where the previous chunk ended, as in sequential parsing
+        if (c->ctx.id_base_known && (c->ctx.id_base != details_cnt))
+        {
+            printf("Detail id %ld out of sequence, expected %d\n", c->ctx.id_base + 1, details_cnt + 1);
+            PARSE_FAIL(E_ABORT);
+        }
+        details_cnt += c->project.details_cnt;
     }
 
-    BOOL is_empty = FALSE;
+    DETAIL_DEF_T *details = (DETAIL_DEF_T *)realloc(project->details, MAX(details_cnt, 1) * sizeof(DETAIL_DEF_T));
+    if (details == NULL)
+    {
+        PARSE_FAIL(E_ABORT);
+    }
+    project->details = details;
+    project->details_size = MAX(details_cnt, 1);
 
-    //read until there are no more nodes
-    while (S_OK == (hr = pReader->Read(&nodeType)))
+    for (size_t i = 0; i < chunks.size(); i++)
     {
-        switch (nodeType)
+        VIYAR_CHUNK_T *c = &chunks[i];
+        int base = project->details_cnt;
+        for (int j = 0; j < c->project.details_cnt; j++)
         {
-            case XmlNodeType_XmlDeclaration:
-                wprintf(L"XmlDeclaration\n");
-                if (FAILED(hr = WriteAttributes(pReader, L"Declaration", _parse_declaration, NULL)))
-                {
-                    wprintf(L"Error writing attributes, error is %08.8lx", hr);
-                    HR(hr);
-                }
-                break;
-            case XmlNodeType_Element:
-                if (FAILED(hr = pReader->GetPrefix(&pwszPrefix, &cwchPrefix)))
-                {
-                    wprintf(L"Error getting prefix, error is %08.8lx", hr);
-                    HR(hr);
-                }
-                if (FAILED(hr = pReader->GetLocalName(&pwszLocalName, NULL)))
-                {
-                    wprintf(L"Error getting local name, error is %08.8lx", hr);
-                    HR(hr);
-                }
-                /*
-                            if (cwchPrefix > 0)
-                                wprintf(L"Element: %s:%s\n", pwszPrefix, pwszLocalName);
-                            else
-                                wprintf(L"Element: %s\n", pwszLocalName);
-                */
+            DETAIL_DEF_T *d = &project->details[project->details_cnt++];
+            *d = c->project.details[j];
+            d->id += base;
+        }
+        // Operations and strings stay where they are, the project takes over their blocks
+        arena_merge(&project->arena, &c->project.arena);
+    }
 
-                // for empty elements call _element_end after parsing attributes
-                is_empty = pReader->IsEmptyElement();
+    return S_OK;
+}
 
-                if (FAILED(hr = WriteAttributes(pReader, pwszLocalName, _parse_element, NULL)))
-                {
-                    wprintf(L"Error writing attributes, error is %08.8lx", hr);
-                    HR(hr);
-                }
+int parse_xml_stream(const wchar_t* xmlfilename, VIYAR_PROJECT_T *project /* out */, detail_cb cb, void *data)
+{
+    HRESULT hr = S_OK;
+    VIYAR_PARSER_T ctx;
+    MAPPED_FILE_T mf;
 
-                if (is_empty)
-                {
-                    hr = _element_end(pwszLocalName, NULL);
-                    CHKHR(hr);
-                }
+    _parser_init(&ctx, project, cb, data);
 
-                break;
-            case XmlNodeType_EndElement:
-                if (FAILED(hr = pReader->GetPrefix(&pwszPrefix, &cwchPrefix)))
-                {
-                    wprintf(L"Error getting prefix, error is %08.8lx", hr);
-                    HR(hr);
-                }
-                if (FAILED(hr = pReader->GetLocalName(&pwszLocalName, NULL)))
-                {
-                    wprintf(L"Error getting local name, error is %08.8lx", hr);
-                    HR(hr);
-                }
-                /*
-                            if (cwchPrefix > 0)
-                                wprintf(L"End Element: %s:%s\n", pwszPrefix, pwszLocalName);
-                            else
-                                wprintf(L"End Element: %s\n", pwszLocalName);
-                */
-                hr = _element_end(pwszLocalName, NULL);
-                CHKHR(hr);
-                break;
-            case XmlNodeType_Text:
-            case XmlNodeType_Whitespace:
-                if (FAILED(hr = pReader->GetValue(&pwszValue, NULL)))
-                {
-                    wprintf(L"Error getting value, error is %08.8lx", hr);
-                    HR(hr);
-                }
-                //wprintf(L"Text: >%s<\n", pwszValue);
-                break;
-            case XmlNodeType_CDATA:
-                if (FAILED(hr = pReader->GetValue(&pwszValue, NULL)))
-                {
-                    wprintf(L"Error getting value, error is %08.8lx", hr);
-                    HR(hr);
-                }
-                wprintf(L"CDATA: %s\n", pwszValue);
-                break;
-            case XmlNodeType_ProcessingInstruction:
-                if (FAILED(hr = pReader->GetLocalName(&pwszLocalName, NULL)))
-                {
-                    wprintf(L"Error getting name, error is %08.8lx", hr);
-                    HR(hr);
-                }
-                if (FAILED(hr = pReader->GetValue(&pwszValue, NULL)))
-                {
-                    wprintf(L"Error getting value, error is %08.8lx", hr);
-                    HR(hr);
-                }
-                wprintf(L"Processing Instruction name:%s value:%s\n", pwszLocalName, pwszValue);
-                break;
-            case XmlNodeType_Comment:
-                if (FAILED(hr = pReader->GetValue(&pwszValue, NULL)))
-                {
-                    wprintf(L"Error getting value, error is %08.8lx", hr);
-                    HR(hr);
-                }
-                wprintf(L"Comment: %s\n", pwszValue);
-                break;
-            case XmlNodeType_DocumentType:
-                wprintf(L"DOCTYPE is not printed\n");
-                break;
+    //Map read-only input file, attribute values are passed as views into it
+    if (file_map(xmlfilename, &mf) != 0)
+    {
+        printf("Error mapping project file\n");
+        return E_ABORT;
+    }
+
+    hr = _sax_parse(&ctx, mf.data, mf.size);
+    if (!FAILED(hr))
+    {
+        hr = (ctx.model_state == MODEL_CLOSED) ? S_OK : E_ABORT;
+    }
+
+    _parser_free(&ctx);
+
+    file_unmap(&mf);
+    return hr;
+}
+
+int parse_xml_parallel(const wchar_t* xmlfilename, VIYAR_PROJECT_T *project /* out */, size_t num_workers)
+{
+    if (num_workers == 0)
+    {
+        num_workers = MAX(std::thread::hardware_concurrency(), 1u);
+    }
+    if (num_workers == 1)
+    {
+        return parse_xml_stream(xmlfilename, project, NULL, NULL);
+    }
+
+    MAPPED_FILE_T mf;
+    if (file_map(xmlfilename, &mf) != 0)
+    {
+        printf("Error mapping project file\n");
+        return E_ABORT;
+    }
+
+    const char *buf = mf.data;
+    size_t size = mf.size;
+    size_t details = _find_tag(buf, size, 0, "<details", 8);
+    size_t first = _find_tag(buf, size, details, "<detail", 7);
+    size_t end = _rfind_tag(buf, size, "</details", 9);
+
+    if ((details == size) || (end == size) || (first >= end))
+    {
+        // Nothing to split: no details, or element names with namespace prefix
+        file_unmap(&mf);
+        return parse_xml_stream(xmlfilename, project, NULL, NULL);
+    }
+
+    //Split details into runs of whole <detail> elements of about equal size
+    std::vector<size_t> bounds(1, first);
+    for (size_t i = 1; i < num_workers; i++)
+    {
+        size_t target = first + (end - first) / num_workers * i;
+        if (target <= bounds.back())
+        {
+            continue;
+        }
+        size_t next = _find_tag(buf, end, target, "<detail", 7);
+        if (next < end)
+        {
+            bounds.push_back(next);
         }
     }
+    bounds.push_back(end);
 
-#if 0
-    for (size_t i = 0; i < p->details_cnt; i++)
+    //Materials first: document with details cut out is parsed as usual,
+    //it also checks project structure around <details>
+    size_t outer_size = first + (size - end);
+    char *outer = (char *)malloc(outer_size);
+    if (outer == NULL)
     {
-        printf("Detail %zd:\n", i);
-        _dump_detail(&details[i]);
+        file_unmap(&mf);
+        return E_ABORT;
+    }
+    memcpy(outer, buf, first);
+    memcpy(outer + first, buf + end, size - end);
+
+    VIYAR_PARSER_T ctx;
+    _parser_init(&ctx, project, NULL, NULL);
+    HRESULT hr = _sax_parse(&ctx, outer, outer_size);
+    if (!FAILED(hr))
+    {
+        hr = (ctx.model_state == MODEL_CLOSED) ? S_OK : E_ABORT;
+    }
+    _parser_free(&ctx);
+    free(outer);
+
+    if (FAILED(hr))
+    {
+        file_unmap(&mf);
+        return hr;
+    }
+
+    std::vector<VIYAR_CHUNK_T> chunks(bounds.size() - 1);
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        VIYAR_CHUNK_T *c = &chunks[i];
+        c->buf = buf + bounds[i];
+        c->size = bounds[i+1] - bounds[i];
+        c->project = project_init();
+        c->project.materials = project->materials;
+        c->project.materials_cnt = project->materials_cnt;
+
+        _parser_init(&c->ctx, &c->project, NULL, NULL);
+        c->ctx.state = STATE_DETAILS;
+        c->ctx.model_state = MODEL_OPENED;
+        c->ctx.id_base_known = false;
     }
-#endif
-    hr = S_OK;
 
-    CHKHR(_model_state == MODEL_CLOSED ? S_OK : E_ABORT);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunks.size(); i++)
+    {
+        workers.emplace_back(_parse_chunk, &chunks[i]);
+    }
+    _parse_chunk(&chunks[0]);
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
 
-CleanUp:
-    SAFE_RELEASE(pFileStream);
-    SAFE_RELEASE(pReader);
+    hr = _join_chunks(project, chunks);
+
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        // Materials belong to project, details were copied or are dropped on error
+        arena_free(&chunks[i].project.arena);
+        free(chunks[i].project.details);
+    }
+
+    file_unmap(&mf);
     return hr;
+}
 
+int parse_xml(const wchar_t* xmlfilename, VIYAR_PROJECT_T *project /* out */)
+{
+    return parse_xml_stream(xmlfilename, project, NULL, NULL);
 }
 
 VIYAR_PROJECT_T project_init()
@@ -910,8 +1344,108 @@ VIYAR_PROJECT_T project_init()
     return project;
 }
 
+void detail_destroy(DETAIL_DEF_T *detail)
+{
+    free(detail->storage);
+    memset(detail, 0, sizeof(*detail));
+}
+
+#define HASH_FNV_OFFSET 0xCBF29CE484222325ULL
+#define HASH_FNV_PRIME  0x00000100000001B3ULL
+
+static unsigned long long _hash_add(unsigned long long h, long long value)
+{
+    unsigned long long v = (unsigned long long)value;
+    for (int i = 0; i < 8; i++)
+    {
+        h ^= (v >> (i * 8)) & 0xFF;
+        h *= HASH_FNV_PRIME;
+    }
+    return h;
+}
+
+static unsigned long long _hash_add_mm(unsigned long long h, double value)
+{
+    return _hash_add(h, llround(value / DETAIL_HASH_PRECISION));
+}
+
+static unsigned long long _hash_add_material(unsigned long long h, const VIYAR_PROJECT_T *project, int m_id)
+{
+    if ((m_id <= 0) || (m_id > project->materials_cnt))
+    {
+        return _hash_add(h, 0);
+    }
+
+    const MATERIAL_DEF_T *m = &project->materials[m_id-1];
+    h = _hash_add(h, m->type);
+    return _hash_add_mm(h, m->thickness);
+}
+
+unsigned long long detail_hash(const DETAIL_DEF_T *detail, const VIYAR_PROJECT_T *project)
+{
+    unsigned long long h = HASH_FNV_OFFSET;
+
+    h = _hash_add_mm(h, detail->width);
+    h = _hash_add_mm(h, detail->height);
+    h = _hash_add_mm(h, detail->thickness);
+
+    for (int i = 0; i < 6; i++)
+    {
+        h = _hash_add_material(h, project, detail->m_bands[i]);
+    }
+
+    //One operation per corner, the last one wins as in geometry generation
+    const OPERATION_T *corner[CORNER_MAX];
+    memset(corner, 0, sizeof(corner));
+
+    //Drilling order does not change geometry, so combine drills commutatively
+    unsigned long long drills = 0;
+
+    for (size_t j = 0; j < detail->operations_cnt; j++)
+    {
+        const OPERATION_T *op = &detail->operations[j];
+        if ((op->type == TYPE_CORNEROPERATION) && (op->corner > 0) && (op->corner <= CORNER_MAX))
+        {
+            corner[op->corner-1] = op;
+        }
+        else if (op->type == TYPE_DRILLING)
+        {
+            unsigned long long dh = HASH_FNV_OFFSET;
+            dh = _hash_add(dh, op->side);
+            dh = _hash_add_mm(dh, op->x);
+            dh = _hash_add_mm(dh, op->y);
+            dh = _hash_add_mm(dh, op->d);
+            dh = _hash_add_mm(dh, op->depth);
+            drills += dh ^ (dh >> 29);
+        }
+    }
+
+    for (int cn = 0; cn < CORNER_MAX; cn++)
+    {
+        const OPERATION_T *op = corner[cn];
+        if (op == NULL)
+        {
+            h = _hash_add(h, 0);
+            continue;
+        }
+
+        h = _hash_add(h, op->subtype);
+        h = _hash_add(h, op->ext);
+        h = _hash_add(h, op->mill);
+        h = _hash_add_mm(h, op->x);
+        h = _hash_add_mm(h, op->y);
+        h = _hash_add_mm(h, op->r);
+        h = _hash_add(h, op->edgeCovering);
+        h = _hash_add_material(h, project, op->edgeMaterial);
+    }
+
+    return _hash_add(h, (long long)drills);
+}
+
 void project_destroy(VIYAR_PROJECT_T *project)
 {
+    // Details of project share the arena, no need to walk them
+    arena_free(&project->arena);
     free(project->materials);
     free(project->details);
     memset(project, 0, sizeof(*project));
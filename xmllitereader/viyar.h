@@ -6,6 +6,7 @@
 /*                     Global Definitions                      */
 /***************************************************************/
 
+#define DETAIL_HASH_PRECISION 0.01 //mm, dimensions closer than this hash equal
 
 /***************************************************************/
 /*                       Global Types                          */
@@ -43,6 +44,7 @@ typedef struct {
 } OPERATION_T;
 
 typedef struct {
+    int id; //1-based position in project
     wchar_t *name;
     int material_id;
     double width;
@@ -54,6 +56,7 @@ typedef struct {
     int m_bands[6];
     size_t operations_cnt;
     OPERATION_T *operations; //dynamic array
+    void *storage; //single block with operations and strings, NULL if owned by project arena
 } DETAIL_DEF_T;
 
 typedef enum {
@@ -72,8 +75,16 @@ typedef struct {
     DETAIL_DEF_T *details; //dynamic array
     int materials_cnt;
     int details_cnt;
+    int materials_size; //allocated elements
+    int details_size;
+    ARENA_T arena; //operations and strings of all details
 } VIYAR_PROJECT_T;
 
+/* Streaming mode callback, called on </detail>. The callback takes ownership of
+ * the detail (release it with detail_destroy()), project->materials are
+ * complete and stay unchanged from the first call on. */
+typedef HRESULT (*detail_cb)(DETAIL_DEF_T *detail, const VIYAR_PROJECT_T *project, void *data);
+
 /***************************************************************/
 /*                  Function declarations                      */
 /***************************************************************/
@@ -82,5 +93,25 @@ VIYAR_PROJECT_T project_init();
 
 void project_destroy(VIYAR_PROJECT_T *project);
 
+/* Reentrant: all parser state lives in a per-call context, so several files
+ * may be parsed concurrently as long as each call gets its own project.
+ * Parses on the calling thread only */
 int parse_xml(const wchar_t* xmlfilename, VIYAR_PROJECT_T *project /* out */);
 
+/* Opt-in for a single large project: materials are parsed first, then
+ * <details> is split on <detail> boundaries and the parts are parsed on
+ * num_workers threads (0 selects number of cores). Result is the same as
+ * parse_xml(); on error no details are stored */
+int parse_xml_parallel(const wchar_t* xmlfilename, VIYAR_PROJECT_T *project /* out */, size_t num_workers);
+
+/* Same as parse_xml() but details are passed to cb instead of being stored
+ * in project->details (only project->details_cnt is updated) */
+int parse_xml_stream(const wchar_t* xmlfilename, VIYAR_PROJECT_T *project /* out */, detail_cb cb, void *data);
+
+void detail_destroy(DETAIL_DEF_T *detail);
+
+/* Canonical geometry hash: size, band materials, corner operations and drilling.
+ * Name, amount and id are not included, so identical panels hash equal.
+ * Materials are hashed by type and thickness rather than by id. */
+unsigned long long detail_hash(const DETAIL_DEF_T *detail, const VIYAR_PROJECT_T *project);
+
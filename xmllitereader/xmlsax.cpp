@@ -0,0 +1,483 @@
+#include "xmlsax.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__AVX2__)
+#define SAX_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define SAX_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+extern "C"
+{
+
+/***************************************************************/
+/*                     Local Definitions                       */
+/***************************************************************/
+
+#define SAX_FAIL(pos)   do { _sax_error(buf, (pos), __LINE__); return XML_SAX_ERROR; } while(0)
+#define SAX_CALL(stmt)  do { int _res = (stmt); if (_res < 0) return _res; } while(0)
+
+/* Long runs (text between tags, attribute values) are scanned SAX_VECTOR
+ * bytes at a time: compare gives a bitmask (bit i = byte pos + i) and the
+ * parser jumps to the first set bit. Names and whitespace are only a few
+ * bytes long and stay scalar, vector setup costs more than it saves there */
+#if defined(SAX_AVX2)
+#define SAX_VECTOR      32
+#define SAX_LOAD(p)     _mm256_loadu_si256((const __m256i *)(p))
+#define SAX_EQ(v, c)    _mm256_cmpeq_epi8((v), _mm256_set1_epi8(c))
+#define SAX_MASK(v)     ((unsigned)_mm256_movemask_epi8(v))
+#elif defined(SAX_SSE2)
+#define SAX_VECTOR      16
+#define SAX_LOAD(p)     _mm_loadu_si128((const __m128i *)(p))
+#define SAX_EQ(v, c)    _mm_cmpeq_epi8((v), _mm_set1_epi8(c))
+#define SAX_MASK(v)     ((unsigned)_mm_movemask_epi8(v))
+#endif
+
+/***************************************************************/
+/*                     Local Variables                         */
+/***************************************************************/
+
+/* windows-1251 0x80..0xFF to UCS */
+static const unsigned short _cp1251[128] = {
+    0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+    0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x0098, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+    0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+    0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+    0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+    0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+    0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+    0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+    0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+    0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+    0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+    0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+    0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+    0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+};
+
+/***************************************************************/
+/*                     Local Functions                         */
+/***************************************************************/
+
+static void _sax_error(const char *buf, size_t pos, int src_line)
+{
+    size_t line = 1;
+    for (size_t i = 0; i < pos; i++)
+    {
+        if (buf[i] == '\n')
+        {
+            line++;
+        }
+    }
+    printf("XML_SAX_FAIL line %d: syntax error at document line %zd\n", src_line, line);
+}
+
+static inline bool _is_space(char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+static inline bool _is_name_end(char c)
+{
+    return _is_space(c) || (c == '>') || (c == '/') || (c == '=');
+}
+
+/* Return position of pattern in buf[pos..size) or size if not found */
+static size_t _find(const char *buf, size_t size, size_t pos, const char *pattern, size_t pattern_len)
+{
+    while (pos + pattern_len <= size)
+    {
+        const char *c = (const char *)memchr(buf + pos, pattern[0], size - pos - pattern_len + 1);
+        if (c == NULL)
+        {
+            break;
+        }
+        pos = c - buf;
+        if (memcmp(c, pattern, pattern_len) == 0)
+        {
+            return pos;
+        }
+        pos++;
+    }
+    return size;
+}
+
+#ifdef SAX_VECTOR
+static inline unsigned _ctz(unsigned m)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return i;
+#else
+    return (unsigned)__builtin_ctz(m);
+#endif
+}
+#endif
+
+/* First position in [pos, size) that is not whitespace, size if none */
+static inline size_t _skip_space(const char *buf, size_t size, size_t pos)
+{
+    while ((pos < size) && _is_space(buf[pos]))
+    {
+        pos++;
+    }
+    return pos;
+}
+
+/* First position of c in [pos, size), size if none */
+static inline size_t _find_char(const char *buf, size_t size, size_t pos, char c)
+{
+#ifdef SAX_VECTOR
+    for (; pos + SAX_VECTOR <= size; pos += SAX_VECTOR)
+    {
+        unsigned m = SAX_MASK(SAX_EQ(SAX_LOAD(buf + pos), c));
+        if (m)
+        {
+            return pos + _ctz(m);
+        }
+    }
+#endif
+    while ((pos < size) && (buf[pos] != c))
+    {
+        pos++;
+    }
+    return pos;
+}
+
+/* End of name starting at pos. *local is where the name without namespace
+ * prefix starts, the same way IXmlReader::GetLocalName() did */
+static inline size_t _scan_name(const char *buf, size_t size, size_t pos, size_t *local)
+{
+    bool prefixed = false;
+    *local = pos;
+
+    for (; (pos < size) && !_is_name_end(buf[pos]); pos++)
+    {
+        if ((buf[pos] == ':') && !prefixed)
+        {
+            *local = pos + 1;
+            prefixed = true;
+        }
+    }
+    return pos;
+}
+
+/***************************************************************/
+/*                     Global Functions                        */
+/***************************************************************/
+
+int xml_sax_parse(const char *buf, size_t size, const XML_SAX_CB_T *cb, void *data)
+{
+    XML_VIEW_T stack[XML_SAX_MAX_DEPTH];
+    size_t depth = 0;
+    size_t pos = 0;
+
+    //Skip UTF-8 BOM
+    if ((size >= 3) && (memcmp(buf, "\xEF\xBB\xBF", 3) == 0))
+    {
+        pos = 3;
+    }
+
+    while (pos < size)
+    {
+        //Text and whitespace between tags is ignored
+        pos = _find_char(buf, size, pos, '<');
+        if (pos == size)
+        {
+            break;
+        }
+        pos++;
+
+        if (pos >= size)
+        {
+            SAX_FAIL(pos);
+        }
+
+        if (buf[pos] == '?')
+        {
+            //XmlDeclaration or ProcessingInstruction
+            pos = _find(buf, size, pos, "?>", 2);
+            if (pos == size)
+            {
+                SAX_FAIL(pos);
+            }
+            pos += 2;
+        }
+        else if (buf[pos] == '!')
+        {
+            if ((size - pos >= 3) && (memcmp(buf + pos, "!--", 3) == 0))
+            {
+                pos = _find(buf, size, pos + 3, "-->", 3);
+                if (pos == size)
+                {
+                    SAX_FAIL(pos);
+                }
+                pos += 3;
+            }
+            else if ((size - pos >= 8) && (memcmp(buf + pos, "![CDATA[", 8) == 0))
+            {
+                pos = _find(buf, size, pos + 8, "]]>", 3);
+                if (pos == size)
+                {
+                    SAX_FAIL(pos);
+                }
+                pos += 3;
+            }
+            else
+            {
+                //DOCTYPE - DTD processing is prohibited
+                SAX_FAIL(pos);
+            }
+        }
+        else if (buf[pos] == '/')
+        {
+            size_t start = ++pos;
+            size_t local;
+            pos = _scan_name(buf, size, pos, &local);
+            size_t len = pos - start;
+            pos = _skip_space(buf, size, pos);
+            if ((pos == size) || (buf[pos] != '>') || (depth == 0))
+            {
+                SAX_FAIL(pos);
+            }
+            pos++;
+
+            depth--;
+            if ((stack[depth].len != len) || (memcmp(stack[depth].ptr, buf + start, len) != 0))
+            {
+                SAX_FAIL(start);
+            }
+
+            XML_VIEW_T element = {buf + local, start + len - local};
+            if (cb->element_end)
+            {
+                SAX_CALL(cb->element_end(&element, data));
+            }
+        }
+        else
+        {
+            size_t start = pos;
+            size_t local;
+            pos = _scan_name(buf, size, pos, &local);
+            if (pos == start)
+            {
+                SAX_FAIL(pos);
+            }
+
+            XML_VIEW_T qname = {buf + start, pos - start};
+            XML_VIEW_T element = {buf + local, pos - local};
+
+            if (cb->element_start)
+            {
+                SAX_CALL(cb->element_start(&element, data));
+            }
+
+            bool is_empty = false;
+            for (;;)
+            {
+                pos = _skip_space(buf, size, pos);
+                if (pos == size)
+                {
+                    SAX_FAIL(pos);
+                }
+
+                if (buf[pos] == '>')
+                {
+                    pos++;
+                    break;
+                }
+
+                if (buf[pos] == '/')
+                {
+                    if ((pos + 1 == size) || (buf[pos + 1] != '>'))
+                    {
+                        SAX_FAIL(pos);
+                    }
+                    pos += 2;
+                    is_empty = true;
+                    break;
+                }
+
+                size_t name_local;
+                pos = _scan_name(buf, size, pos, &name_local);
+                XML_VIEW_T name = {buf + name_local, pos - name_local};
+
+                pos = _skip_space(buf, size, pos);
+                if ((name.len == 0) || (pos == size) || (buf[pos] != '='))
+                {
+                    SAX_FAIL(pos);
+                }
+                pos = _skip_space(buf, size, pos + 1);
+                if ((pos == size) || ((buf[pos] != '"') && (buf[pos] != '\'')))
+                {
+                    SAX_FAIL(pos);
+                }
+
+                char quote = buf[pos++];
+                size_t end = _find_char(buf, size, pos, quote);
+                if (end == size)
+                {
+                    SAX_FAIL(pos);
+                }
+
+                XML_VIEW_T value = {buf + pos, end - pos};
+                pos = end + 1;
+
+                if (cb->attribute)
+                {
+                    SAX_CALL(cb->attribute(&element, &name, &value, data));
+                }
+            }
+
+            if (is_empty)
+            {
+                if (cb->element_end)
+                {
+                    SAX_CALL(cb->element_end(&element, data));
+                }
+            }
+            else
+            {
+                if (depth == XML_SAX_MAX_DEPTH)
+                {
+                    SAX_FAIL(start);
+                }
+                stack[depth++] = qname;
+            }
+        }
+    }
+
+    if (depth != 0)
+    {
+        SAX_FAIL(size);
+    }
+
+    return 0;
+}
+
+size_t xml_view_decode(const XML_VIEW_T *v, wchar_t *out /* v->len + 1 */)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < v->len; i++)
+    {
+        unsigned char c = (unsigned char)v->ptr[i];
+
+        if (c == '&')
+        {
+            const char *semi = (const char *)memchr(v->ptr + i, ';', v->len - i);
+            if (semi)
+            {
+                const char *ent = v->ptr + i + 1;
+                size_t ent_len = semi - ent;
+                unsigned long ch = 0;
+
+                if ((ent_len == 3) && (memcmp(ent, "amp", 3) == 0))       ch = '&';
+                else if ((ent_len == 2) && (memcmp(ent, "lt", 2) == 0))   ch = '<';
+                else if ((ent_len == 2) && (memcmp(ent, "gt", 2) == 0))   ch = '>';
+                else if ((ent_len == 4) && (memcmp(ent, "quot", 4) == 0)) ch = '"';
+                else if ((ent_len == 4) && (memcmp(ent, "apos", 4) == 0)) ch = '\'';
+                else if ((ent_len > 1) && (ent[0] == '#'))
+                {
+                    if ((ent[1] == 'x') || (ent[1] == 'X'))
+                    {
+                        ch = strtoul(ent + 2, NULL, 16);
+                    }
+                    else
+                    {
+                        ch = strtoul(ent + 1, NULL, 10);
+                    }
+                }
+
+                if (ch != 0)
+                {
+                    out[n++] = (wchar_t)ch;
+                    i += ent_len + 1;
+                    continue;
+                }
+            }
+        }
+
+        out[n++] = (c < 0x80) ? (wchar_t)c : (wchar_t)_cp1251[c - 0x80];
+    }
+    out[n] = L'\0';
+
+    return n;
+}
+
+wchar_t *xml_view_to_wcs(const XML_VIEW_T *v)
+{
+    wchar_t *out = (wchar_t *)malloc((v->len + 1) * sizeof(wchar_t));
+    if (out)
+    {
+        xml_view_decode(v, out);
+    }
+    return out;
+}
+
+/* View without surrounding whitespace */
+static XML_VIEW_T _trim(const XML_VIEW_T *v)
+{
+    XML_VIEW_T t = *v;
+    while ((t.len > 0) && _is_space(t.ptr[0]))
+    {
+        t.ptr++;
+        t.len--;
+    }
+    while ((t.len > 0) && _is_space(t.ptr[t.len - 1]))
+    {
+        t.len--;
+    }
+    return t;
+}
+
+int xml_view_to_long(const XML_VIEW_T *v, long *value)
+{
+    XML_VIEW_T t = _trim(v);
+    long n;
+    NUM_RESULT_T res = num_from_chars_long(t.ptr, t.ptr + t.len, &n);
+    if (res.ec != NUM_OK)
+    {
+        return res.ec;
+    }
+    if (res.ptr != t.ptr + t.len)
+    {
+        return NUM_INVALID;
+    }
+    *value = n;
+    return NUM_OK;
+}
+
+int xml_view_to_double(const XML_VIEW_T *v, double *value)
+{
+    XML_VIEW_T t = _trim(v);
+    double d;
+    NUM_RESULT_T res = num_from_chars_double(t.ptr, t.ptr + t.len, &d);
+    if (res.ec != NUM_OK)
+    {
+        return res.ec;
+    }
+    if (res.ptr != t.ptr + t.len)
+    {
+        return NUM_INVALID;
+    }
+    *value = d;
+    return NUM_OK;
+}
+
+bool xml_view_blank(const XML_VIEW_T *v)
+{
+    return _trim(v).len == 0;
+}
+
+} //extern "C"
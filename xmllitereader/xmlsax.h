@@ -0,0 +1,64 @@
+#pragma once
+
+#include "common.h"
+#include "numconv.h"
+
+#include <string.h>
+
+/***************************************************************/
+/*                     Global Definitions                      */
+/***************************************************************/
+
+#define XML_SAX_ERROR       (-1)
+#define XML_SAX_MAX_DEPTH   64
+
+/* Compare view with string literal */
+#define XML_VIEW_EQ(v, lit) (((v)->len == sizeof(lit) - 1) && (memcmp((v)->ptr, (lit), sizeof(lit) - 1) == 0))
+
+/* printf("%.*s") helpers */
+#define XML_VIEW_FMT        "%.*s"
+#define XML_VIEW_ARG(v)     (int)(v)->len, (v)->ptr
+
+/***************************************************************/
+/*                       Global Types                          */
+/***************************************************************/
+
+extern "C"
+{
+
+/* Non-owning window into the parsed buffer (not NUL terminated) */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} XML_VIEW_T;
+
+/* Callbacks return negative value to abort parsing; the value is returned from xml_sax_parse() */
+typedef int (*xml_element_cb)(const XML_VIEW_T *element, void *data);
+typedef int (*xml_attribute_cb)(const XML_VIEW_T *element,
+                                const XML_VIEW_T *name,
+                                const XML_VIEW_T *value,
+                                void *data);
+
+typedef struct {
+    xml_element_cb element_start;
+    xml_attribute_cb attribute;
+    xml_element_cb element_end;   //called for empty elements <a/> too
+} XML_SAX_CB_T;
+
+/***************************************************************/
+/*                  Function declarations                      */
+/***************************************************************/
+
+int xml_sax_parse(const char *buf, size_t size, const XML_SAX_CB_T *cb, void *data);
+
+/* Attribute values are raw bytes of windows-1251 document */
+size_t xml_view_decode(const XML_VIEW_T *v, wchar_t *out /* v->len + 1 */); //entities decoded
+wchar_t *xml_view_to_wcs(const XML_VIEW_T *v); //malloc'ed
+
+/* Whole view (surrounding spaces allowed) must be a number, independent of
+ * locale. Returns NUM_OK, NUM_INVALID or NUM_RANGE; value is only set on NUM_OK */
+int xml_view_to_long(const XML_VIEW_T *v, long *value /* out */);
+int xml_view_to_double(const XML_VIEW_T *v, double *value /* out */);
+bool xml_view_blank(const XML_VIEW_T *v); //empty or spaces only
+
+} //extern "C"